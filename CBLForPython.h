@@ -569,6 +569,7 @@ typedef void (*CBLQueryChangeListener)(void *context,
                                        CBLQuery* query,
                                        CBLListenerToken *token);
 extern "Python" void queryListenerCallback(void *context, const CBLQuery *query);
+extern "Python" void liveQueryListenerCallback(void *context, CBLQuery *query, CBLListenerToken *token);
 CBLListenerToken* CBLQuery_AddChangeListener(CBLQuery* query,
                                         CBLQueryChangeListener listener,
                                         void *context);
@@ -945,6 +946,8 @@ bool CBLReplicator_IsDocumentPending2(CBLReplicator *repl, FLString docID, const
 typedef void (*CBLReplicatorChangeListener)(void* context,
                                             CBLReplicator *replicator,
                                             const CBLReplicatorStatus *status);
+extern "Python" void replicatorChangeListenerCallback(void* context, CBLReplicator *replicator,
+                                                      const CBLReplicatorStatus *status);
 
 /** Adds a listener that will be called when the replicator's status changes. */
 CBLListenerToken* CBLReplicator_AddChangeListener(CBLReplicator*,
@@ -0,0 +1,2468 @@
+//
+// CBLForPython_Native.c
+//
+// Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+/*
+    This file is compiled by `build.py` into a small CPython extension module called
+    `_PyCBLNative`, which lives next to the CFFI-generated `_PyCBL` module.
+
+    CFFI can't create or inspect Python objects from C, so operations that would otherwise need
+    one FFI crossing per Fleece value (decoding a document into dicts and lists, for instance)
+    are implemented here instead, and called once per document.
+
+    Couchbase Lite objects are passed between the two modules as integer addresses; in Python,
+    use `common.address(cdata)` to get one, and `ffi.cast` to turn one back into a pointer.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <cbl/CouchbaseLite.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void* asPointer(PyObject *addr) {
+    if (addr == Py_None)
+        return NULL;
+    return PyLong_AsVoidPtr(addr);
+}
+
+
+//////// KEY CACHE
+
+
+// Dict keys are highly repetitive across documents (they're usually Fleece "shared keys"), so
+// decoded key strings are interned and kept in a small direct-mapped cache. A hit returns the
+// existing `str` object instead of decoding and allocating a new one.
+
+#define kKeyCacheSize       1024                // must be a power of 2
+#define kMaxCachedKeyLength 64
+
+typedef struct {
+    uint32_t  hash;
+    PyObject* str;
+} CachedKey;
+
+static CachedKey sKeyCache[kKeyCacheSize];
+
+
+static PyObject* decodeKey(FLString key) {
+    if (key.size > kMaxCachedKeyLength)
+        return PyUnicode_DecodeUTF8(key.buf, key.size, NULL);
+
+    uint32_t hash = FLSlice_Hash(key);
+    CachedKey *entry = &sKeyCache[hash & (kKeyCacheSize - 1)];
+    if (entry->str && entry->hash == hash) {
+        Py_ssize_t size;
+        const char *utf8 = PyUnicode_AsUTF8AndSize(entry->str, &size);
+        if (utf8 && (size_t)size == key.size && memcmp(utf8, key.buf, key.size) == 0) {
+            Py_INCREF(entry->str);
+            return entry->str;
+        }
+    }
+
+    PyObject *str = PyUnicode_DecodeUTF8(key.buf, key.size, NULL);
+    if (!str)
+        return NULL;
+    PyUnicode_InternInPlace(&str);
+    Py_XSETREF(entry->str, str);
+    Py_INCREF(str);
+    entry->hash = hash;
+    return str;
+}
+
+
+static void clearKeyCache(void) {
+    for (int i = 0; i < kKeyCacheSize; i++) {
+        Py_CLEAR(sKeyCache[i].str);
+    }
+}
+
+
+//////// FLEECE DECODING
+
+
+// Converts a Fleece value to the equivalent Python object, recursively.
+// Blob dictionaries are passed (as an address) to `blobFactory` unless it's None.
+// Other dictionaries become instances of `dictType` (a dict subclass) if it's not NULL.
+static PyObject* decodeValue(FLValue value, PyObject *blobFactory, PyObject *dictType);
+
+
+static PyObject* decodeArray(FLArray array, PyObject *blobFactory, PyObject *dictType) {
+    uint32_t count = FLArray_Count(array);
+    PyObject *result = PyList_New(count);
+    if (!result)
+        return NULL;
+    FLArrayIterator i;
+    FLArrayIterator_Begin(array, &i);
+    for (uint32_t n = 0; n < count; n++) {
+        PyObject *item = decodeValue(FLArrayIterator_GetValue(&i), blobFactory, dictType);
+        if (!item) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, n, item);
+        FLArrayIterator_Next(&i);
+    }
+    return result;
+}
+
+
+static PyObject* decodeDict(FLDict dict, PyObject *blobFactory, PyObject *dictType) {
+    if (blobFactory != Py_None && FLDict_IsBlob(dict))
+        return PyObject_CallFunction(blobFactory, "K", (unsigned long long)(uintptr_t)dict);
+
+    PyObject *result = dictType ? PyObject_CallNoArgs(dictType) : PyDict_New();
+    if (!result)
+        return NULL;
+    FLDictIterator i;
+    FLDictIterator_Begin(dict, &i);
+    FLValue value;
+    while (NULL != (value = FLDictIterator_GetValue(&i))) {
+        PyObject *key = decodeKey(FLDictIterator_GetKeyString(&i));
+        PyObject *item = key ? decodeValue(value, blobFactory, dictType) : NULL;
+        if (!item || PyDict_SetItem(result, key, item) < 0) {
+            Py_XDECREF(key);
+            Py_XDECREF(item);
+            Py_DECREF(result);
+            FLDictIterator_End(&i);
+            return NULL;
+        }
+        Py_DECREF(key);
+        Py_DECREF(item);
+        FLDictIterator_Next(&i);
+    }
+    return result;
+}
+
+
+static PyObject* decodeValue(FLValue value, PyObject *blobFactory, PyObject *dictType) {
+    switch (FLValue_GetType(value)) {
+        case kFLString: {
+            FLString str = FLValue_AsString(value);
+            return PyUnicode_DecodeUTF8(str.buf, str.size, NULL);
+        }
+        case kFLNumber:
+            if (FLValue_IsInteger(value)) {
+                if (FLValue_IsUnsigned(value))
+                    return PyLong_FromUnsignedLongLong(FLValue_AsUnsigned(value));
+                return PyLong_FromLongLong(FLValue_AsInt(value));
+            }
+            return PyFloat_FromDouble(FLValue_AsDouble(value));
+        case kFLBoolean:
+            return PyBool_FromLong(FLValue_AsBool(value));
+        case kFLDict:
+        case kFLArray: {
+            if (Py_EnterRecursiveCall(" while decoding Fleece"))
+                return NULL;
+            PyObject *result;
+            if (FLValue_GetType(value) == kFLDict)
+                result = decodeDict(FLValue_AsDict(value), blobFactory, dictType);
+            else
+                result = decodeArray(FLValue_AsArray(value), blobFactory, dictType);
+            Py_LeaveRecursiveCall();
+            return result;
+        }
+        case kFLData: {
+            FLSlice data = FLValue_AsData(value);
+            return PyBytes_FromStringAndSize(data.buf, data.size);
+        }
+        default:
+            Py_RETURN_NONE;     // kFLNull, kFLUndefined, or a NULL value
+    }
+}
+
+
+// decode(address, blobFactory=None, dictType=None) -> object
+static PyObject* native_decode(PyObject *self, PyObject *args) {
+    PyObject *addr, *blobFactory = Py_None, *dictType = Py_None;
+    if (!PyArg_ParseTuple(args, "O|OO:decode", &addr, &blobFactory, &dictType))
+        return NULL;
+    FLValue value = asPointer(addr);
+    if (!value) {
+        if (PyErr_Occurred())
+            return NULL;
+        Py_RETURN_NONE;
+    }
+    return decodeValue(value, blobFactory, (dictType != Py_None) ? dictType : NULL);
+}
+
+
+// clearKeyCache() -> None
+static PyObject* native_clearKeyCache(PyObject *self, PyObject *args) {
+    clearKeyCache();
+    Py_RETURN_NONE;
+}
+
+
+//////// FLEECE ENCODING
+
+
+// Stores a Python object into a Fleece slot (a value in a mutable dict or array), recursively.
+// Accepts the same types as `Collections.encodeJSON`: None, bool, int, float, str, dict, list and
+// tuple, plus bytes; any other object has to have a `_blobAddress` attribute (a Blob), or a
+// `_jsonEncodable()` method returning one of those types.
+static bool encodeToSlot(FLSlot slot, PyObject *obj);
+
+
+static bool encodeDictInto(FLMutableDict dict, PyObject *obj) {
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(obj, &pos, &key, &value)) {
+        if (!PyUnicode_Check(key)) {
+            PyErr_Format(PyExc_TypeError, "Couchbase Lite dictionary keys must be strings, not %.100s",
+                         Py_TYPE(key)->tp_name);
+            return false;
+        }
+        Py_ssize_t size;
+        const char *utf8 = PyUnicode_AsUTF8AndSize(key, &size);
+        if (!utf8 || !encodeToSlot(FLMutableDict_Set(dict, (FLString){utf8, (size_t)size}), value))
+            return false;
+    }
+    return true;
+}
+
+
+static bool encodeArrayInto(FLMutableArray array, PyObject *obj) {
+    PyObject *seq = PySequence_Fast(obj, "expected a sequence");
+    if (!seq)
+        return false;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        if (!encodeToSlot(FLMutableArray_Append(array), PySequence_Fast_GET_ITEM(seq, i))) {
+            Py_DECREF(seq);
+            return false;
+        }
+    }
+    Py_DECREF(seq);
+    return true;
+}
+
+
+static bool encodeCollection(FLSlot slot, PyObject *obj, bool isDict) {
+    if (Py_EnterRecursiveCall(" while encoding Fleece"))
+        return false;
+    bool ok;
+    FLValue collection;
+    if (isDict) {
+        FLMutableDict dict = FLMutableDict_New();
+        ok = encodeDictInto(dict, obj);
+        collection = (FLValue)dict;
+    } else {
+        FLMutableArray array = FLMutableArray_New();
+        ok = encodeArrayInto(array, obj);
+        collection = (FLValue)array;
+    }
+    if (ok)
+        FLSlot_SetValue(slot, collection);
+    FLValue_Release(collection);
+    Py_LeaveRecursiveCall();
+    return ok;
+}
+
+
+// Returns the result of calling `obj._jsonEncodable()`, or raises TypeError if it has no such method.
+static PyObject* jsonEncodable(PyObject *obj) {
+    PyObject *value = PyObject_CallMethod(obj, "_jsonEncodable", NULL);
+    if (!value && PyErr_ExceptionMatches(PyExc_AttributeError)) {
+        PyErr_Clear();
+        PyErr_Format(PyExc_TypeError, "Couchbase Lite documents cannot contain objects of type %.100s",
+                     Py_TYPE(obj)->tp_name);
+    }
+    return value;
+}
+
+
+static bool encodeOther(FLSlot slot, PyObject *obj) {
+    PyObject *blobAddr = PyObject_GetAttrString(obj, "_blobAddress");
+    if (blobAddr) {
+        CBLBlob *blob = PyLong_AsVoidPtr(blobAddr);
+        Py_DECREF(blobAddr);
+        if (!blob) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError, "Blob has no content");
+            return false;
+        }
+        FLSlot_SetBlob(slot, blob);
+        return true;
+    } else if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+        return false;
+    }
+    PyErr_Clear();
+
+    PyObject *value = jsonEncodable(obj);
+    if (!value)
+        return false;
+    bool ok = false;
+    if (!Py_EnterRecursiveCall(" while encoding Fleece")) {
+        ok = encodeToSlot(slot, value);
+        Py_LeaveRecursiveCall();
+    }
+    Py_DECREF(value);
+    return ok;
+}
+
+
+static bool encodeToSlot(FLSlot slot, PyObject *obj) {
+    if (obj == Py_None) {
+        FLSlot_SetNull(slot);
+    } else if (PyBool_Check(obj)) {
+        FLSlot_SetBool(slot, obj == Py_True);
+    } else if (PyLong_Check(obj)) {
+        int overflow;
+        long long i = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow > 0) {
+            unsigned long long u = PyLong_AsUnsignedLongLong(obj);
+            if (u == (unsigned long long)-1 && PyErr_Occurred())
+                return false;
+            FLSlot_SetUInt(slot, u);
+        } else if (overflow < 0) {
+            PyErr_SetString(PyExc_OverflowError, "int too small to store in a document");
+            return false;
+        } else if (i == -1 && PyErr_Occurred()) {
+            return false;
+        } else {
+            FLSlot_SetInt(slot, i);
+        }
+    } else if (PyFloat_Check(obj)) {
+        double d = PyFloat_AS_DOUBLE(obj);
+        if (!isfinite(d)) {
+            PyErr_SetString(PyExc_ValueError, "Out of range float values cannot be stored in a document");
+            return false;
+        }
+        FLSlot_SetDouble(slot, d);
+    } else if (PyUnicode_Check(obj)) {
+        Py_ssize_t size;
+        const char *utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+        if (!utf8)
+            return false;
+        FLSlot_SetString(slot, (FLString){utf8, (size_t)size});
+    } else if (PyDict_Check(obj)) {
+        return encodeCollection(slot, obj, true);
+    } else if (PyList_Check(obj) || PyTuple_Check(obj)) {
+        return encodeCollection(slot, obj, false);
+    } else if (PyBytes_Check(obj)) {
+        FLSlot_SetData(slot, (FLSlice){PyBytes_AS_STRING(obj), (size_t)PyBytes_GET_SIZE(obj)});
+    } else {
+        return encodeOther(slot, obj);
+    }
+    return true;
+}
+
+
+// Encodes a Python dict into a new FLMutableDict, or returns NULL on error.
+static FLMutableDict encodeDict(PyObject *props) {
+    if (!PyDict_Check(props)) {
+        PyErr_Format(PyExc_TypeError, "document properties must be a dict, not %.100s",
+                     Py_TYPE(props)->tp_name);
+        return NULL;
+    }
+    FLMutableDict dict = FLMutableDict_New();
+    if (!encodeDictInto(dict, props)) {
+        FLValue_Release((FLValue)dict);
+        return NULL;
+    }
+    return dict;
+}
+
+
+// setDocumentProperties(docAddress, props) -> None
+static PyObject* native_setDocumentProperties(PyObject *self, PyObject *args) {
+    PyObject *addr, *props;
+    if (!PyArg_ParseTuple(args, "OO:setDocumentProperties", &addr, &props))
+        return NULL;
+    CBLDocument *doc = asPointer(addr);
+    if (!doc)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL document");
+    FLMutableDict dict = encodeDict(props);
+    if (!dict)
+        return NULL;
+    CBLDocument_SetProperties(doc, dict);
+    FLValue_Release((FLValue)dict);
+    Py_RETURN_NONE;
+}
+
+
+// Applies the changes recorded in a `Collections._TrackedDict` to the Fleece dict it was decoded
+// from: keys in its `_dirty` set are re-encoded or removed, and nested tracked dicts whose keys
+// are in its `_touched` set are updated recursively. Then it clears both sets. Everything else
+// is left alone, so unchanged Fleece values stay shared with the saved revision.
+static bool applyChanges(FLMutableDict target, PyObject *tracked) {
+    PyObject *dirty = PyObject_GetAttrString(tracked, "_dirty");
+    PyObject *touched = dirty ? PyObject_GetAttrString(tracked, "_touched") : NULL;
+    bool ok = (touched != NULL) && PySet_Check(dirty) && PySet_Check(touched);
+    if (!ok && !PyErr_Occurred())
+        PyErr_SetString(PyExc_TypeError, "expected a _TrackedDict");
+
+    PyObject *iter = ok ? PyObject_GetIter(dirty) : NULL, *key, *value;
+    while (iter && (key = PyIter_Next(iter)) != NULL) {
+        Py_ssize_t size;
+        const char *utf8 = PyUnicode_Check(key) ? PyUnicode_AsUTF8AndSize(key, &size) : NULL;
+        if (!utf8) {
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_TypeError, "Couchbase Lite dictionary keys must be strings, not %.100s",
+                             Py_TYPE(key)->tp_name);
+            Py_DECREF(key);
+            break;
+        }
+        FLString keySlice = {utf8, (size_t)size};
+        value = PyDict_GetItemWithError(tracked, key);
+        if (value)
+            ok = encodeToSlot(FLMutableDict_Set(target, keySlice), value);
+        else if (!PyErr_Occurred())
+            FLMutableDict_Remove(target, keySlice);
+        Py_DECREF(key);
+        if (!ok || PyErr_Occurred())
+            break;
+    }
+    Py_XDECREF(iter);
+    ok = ok && !PyErr_Occurred();
+
+    iter = ok ? PyObject_GetIter(touched) : NULL;
+    while (iter && (key = PyIter_Next(iter)) != NULL) {
+        int isDirty = PySet_Contains(dirty, key);
+        value = (isDirty == 0) ? PyDict_GetItemWithError(tracked, key) : NULL;
+        if (isDirty < 0 || (!value && PyErr_Occurred())) {
+            ok = false;
+        } else if (value && Py_TYPE(value) == Py_TYPE(tracked)) {
+            Py_ssize_t size;
+            const char *utf8 = PyUnicode_AsUTF8AndSize(key, &size);
+            if (!utf8) {
+                ok = false;
+            } else if (Py_EnterRecursiveCall(" while saving changes")) {
+                ok = false;
+            } else {
+                FLString keySlice = {utf8, (size_t)size};
+                FLMutableDict nested = FLMutableDict_GetMutableDict(target, keySlice);
+                if (nested)
+                    ok = applyChanges(nested, value);
+                else
+                    ok = encodeToSlot(FLMutableDict_Set(target, keySlice), value);
+                Py_LeaveRecursiveCall();
+            }
+        }
+        Py_DECREF(key);
+        if (!ok)
+            break;
+    }
+    Py_XDECREF(iter);
+    ok = ok && !PyErr_Occurred();
+
+    if (ok)
+        ok = PySet_Clear(dirty) == 0 && PySet_Clear(touched) == 0;
+    Py_XDECREF(dirty);
+    Py_XDECREF(touched);
+    return ok;
+}
+
+
+// applyDocumentChanges(docAddress, trackedProps) -> None
+static PyObject* native_applyDocumentChanges(PyObject *self, PyObject *args) {
+    PyObject *addr, *props;
+    if (!PyArg_ParseTuple(args, "OO:applyDocumentChanges", &addr, &props))
+        return NULL;
+    CBLDocument *doc = asPointer(addr);
+    if (!doc)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL document");
+    if (!applyChanges(CBLDocument_MutableProperties(doc), props))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+// Writes a Python object to an FLEncoder, recursively. Accepts the same types as `encodeToSlot`.
+// This is cheaper than building mutable collections when the result is only going to be read.
+static bool encodeToEncoder(FLEncoder enc, PyObject *obj) {
+    if (obj == Py_None) {
+        FLEncoder_WriteNull(enc);
+    } else if (PyBool_Check(obj)) {
+        FLEncoder_WriteBool(enc, obj == Py_True);
+    } else if (PyLong_Check(obj)) {
+        int overflow;
+        long long i = PyLong_AsLongLongAndOverflow(obj, &overflow);
+        if (overflow > 0) {
+            unsigned long long u = PyLong_AsUnsignedLongLong(obj);
+            if (u == (unsigned long long)-1 && PyErr_Occurred())
+                return false;
+            FLEncoder_WriteUInt(enc, u);
+        } else if (overflow < 0) {
+            PyErr_SetString(PyExc_OverflowError, "int too small to store in a document");
+            return false;
+        } else if (i == -1 && PyErr_Occurred()) {
+            return false;
+        } else {
+            FLEncoder_WriteInt(enc, i);
+        }
+    } else if (PyFloat_Check(obj)) {
+        double d = PyFloat_AS_DOUBLE(obj);
+        if (!isfinite(d)) {
+            PyErr_SetString(PyExc_ValueError, "Out of range float values cannot be stored in a document");
+            return false;
+        }
+        FLEncoder_WriteDouble(enc, d);
+    } else if (PyUnicode_Check(obj)) {
+        Py_ssize_t size;
+        const char *utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+        if (!utf8)
+            return false;
+        FLEncoder_WriteString(enc, (FLString){utf8, (size_t)size});
+    } else if (PyBytes_Check(obj)) {
+        FLEncoder_WriteData(enc, (FLSlice){PyBytes_AS_STRING(obj), (size_t)PyBytes_GET_SIZE(obj)});
+    } else {
+        bool isDict = PyDict_Check(obj), isArray = PyList_Check(obj) || PyTuple_Check(obj);
+        PyObject *value;
+        if (isDict || isArray) {
+            value = obj;
+            Py_INCREF(value);
+        } else {
+            PyObject *blobAddr = PyObject_GetAttrString(obj, "_blobAddress");
+            if (blobAddr) {
+                CBLBlob *blob = PyLong_AsVoidPtr(blobAddr);
+                Py_DECREF(blobAddr);
+                if (!blob) {
+                    if (!PyErr_Occurred())
+                        PyErr_SetString(PyExc_ValueError, "Blob has no content");
+                    return false;
+                }
+                FLEncoder_WriteValue(enc, (FLValue)CBLBlob_Properties(blob));
+                return true;
+            } else if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                return false;
+            }
+            PyErr_Clear();
+            value = jsonEncodable(obj);
+            if (!value)
+                return false;
+        }
+
+        bool ok = false;
+        if (!Py_EnterRecursiveCall(" while encoding Fleece")) {
+            if (isDict) {
+                ok = true;
+                FLEncoder_BeginDict(enc, (size_t)PyDict_GET_SIZE(value));
+                PyObject *key, *item;
+                Py_ssize_t pos = 0;
+                while (ok && PyDict_Next(value, &pos, &key, &item)) {
+                    Py_ssize_t size;
+                    const char *utf8 = NULL;
+                    if (!PyUnicode_Check(key))
+                        PyErr_Format(PyExc_TypeError, "Couchbase Lite dictionary keys must be strings, not %.100s",
+                                     Py_TYPE(key)->tp_name);
+                    else
+                        utf8 = PyUnicode_AsUTF8AndSize(key, &size);
+                    ok = utf8 && FLEncoder_WriteKey(enc, (FLString){utf8, (size_t)size})
+                              && encodeToEncoder(enc, item);
+                }
+                FLEncoder_EndDict(enc);
+            } else if (isArray) {
+                Py_ssize_t count = PySequence_Fast_GET_SIZE(value);
+                ok = true;
+                FLEncoder_BeginArray(enc, (size_t)count);
+                for (Py_ssize_t i = 0; ok && i < count; i++)
+                    ok = encodeToEncoder(enc, PySequence_Fast_GET_ITEM(value, i));
+                FLEncoder_EndArray(enc);
+            } else {
+                ok = encodeToEncoder(enc, value);
+            }
+            Py_LeaveRecursiveCall();
+        }
+        Py_DECREF(value);
+        return ok;
+    }
+    return true;
+}
+
+
+// A reusable encoder. It's only touched with the GIL held, but encoding can call back into
+// Python (`_jsonEncodable`), which may let another thread in; that thread gets its own encoder.
+static FLEncoder sSharedEncoder;
+static bool sSharedEncoderBusy;
+
+
+// encodeDocument(value) -> FLDoc address
+static PyObject* native_encodeDocument(PyObject *self, PyObject *args) {
+    PyObject *value;
+    if (!PyArg_ParseTuple(args, "O:encodeDocument", &value))
+        return NULL;
+    FLEncoder enc;
+    bool shared = !sSharedEncoderBusy;
+    if (shared) {
+        if (!sSharedEncoder)
+            sSharedEncoder = FLEncoder_New();
+        enc = sSharedEncoder;
+        sSharedEncoderBusy = true;
+    } else {
+        enc = FLEncoder_New();
+    }
+
+    FLDoc doc = NULL;
+    if (encodeToEncoder(enc, value)) {
+        FLError flErr;
+        doc = FLEncoder_FinishDoc(enc, &flErr);
+        if (!doc)
+            PyErr_Format(PyExc_ValueError, "Fleece encoder error %d", (int)flErr);
+    }
+    if (shared) {
+        FLEncoder_Reset(enc);
+        sSharedEncoderBusy = false;
+    } else {
+        FLEncoder_Free(enc);
+    }
+    return doc ? PyLong_FromVoidPtr(doc) : NULL;
+}
+
+
+//////// BULK OPERATIONS
+
+
+// Returns the pending Python exception as an object, clearing it.
+static PyObject* takeException(void) {
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (traceback) {
+        PyException_SetTraceback(value, traceback);
+        Py_DECREF(traceback);
+    }
+    Py_XDECREF(type);
+    return value;
+}
+
+
+static bool appendFailure(PyObject *failures, Py_ssize_t index, PyObject *exception) {
+    PyObject *failure = Py_BuildValue("(nO)", index, exception ? exception : Py_None);
+    Py_XDECREF(exception);
+    if (!failure)
+        return false;
+    int result = PyList_Append(failures, failure);
+    Py_DECREF(failure);
+    return result == 0;
+}
+
+
+// Saves one `(docID, properties, docAddress)` entry, to `collection` if it's non-NULL, else to
+// the database's default collection. Returns false if it failed, in which case either
+// `*outException` is set or the CBL error is stored in `*outError`.
+static bool saveEntry(CBLDatabase *db, CBLCollection *collection, PyObject *entry,
+                      CBLConcurrencyControl concurrency, CBLError *outError, PyObject **outException)
+{
+    PyObject *idObj, *props, *docAddr;
+    if (!PyArg_ParseTuple(entry, "OOO:saveDocuments entry", &idObj, &props, &docAddr))
+        goto pyError;
+    CBLDocument *doc = asPointer(docAddr), *newDoc = NULL;
+    if (!doc) {
+        if (PyErr_Occurred())
+            goto pyError;
+        if (idObj == Py_None) {
+            newDoc = CBLDocument_Create();
+        } else {
+            Py_ssize_t size;
+            const char *id = PyUnicode_AsUTF8AndSize(idObj, &size);
+            if (!id)
+                goto pyError;
+            newDoc = CBLDocument_CreateWithID((FLString){id, (size_t)size});
+        }
+        doc = newDoc;
+    }
+    if (props != Py_None) {
+        FLMutableDict dict = encodeDict(props);
+        if (!dict) {
+            CBL_Release(newDoc);
+            goto pyError;
+        }
+        CBLDocument_SetProperties(doc, dict);
+        FLValue_Release((FLValue)dict);
+    }
+
+    bool saved;
+    Py_BEGIN_ALLOW_THREADS
+    if (collection)
+        saved = CBLCollection_SaveDocumentWithConcurrencyControl(collection, doc, concurrency, outError);
+    else
+        saved = CBLDatabase_SaveDocumentWithConcurrencyControl(db, doc, concurrency, outError);
+    Py_END_ALLOW_THREADS
+    CBL_Release(newDoc);
+    return saved;
+
+pyError:
+    *outException = takeException();
+    return false;
+}
+
+
+// saveDocuments(dbAddress, entries, concurrency, errorsAddress, collectionAddress=None)
+//      -> [(index, exception), ...]
+static PyObject* native_saveDocuments(PyObject *self, PyObject *args) {
+    PyObject *dbAddr, *entries, *errorsAddr, *collectionAddr = Py_None;
+    int concurrency;
+    if (!PyArg_ParseTuple(args, "OOiO|O:saveDocuments", &dbAddr, &entries, &concurrency, &errorsAddr,
+                          &collectionAddr))
+        return NULL;
+    CBLDatabase *db = asPointer(dbAddr);
+    CBLError *errors = asPointer(errorsAddr);
+    CBLCollection *collection = asPointer(collectionAddr);
+    if (PyErr_Occurred())
+        return NULL;
+    if (!db || !errors)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL database or error array");
+    PyObject *seq = PySequence_Fast(entries, "entries must be a sequence");
+    if (!seq)
+        return NULL;
+    PyObject *failures = PyList_New(0);
+    if (!failures) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        PyObject *entry = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *exception = NULL;
+        Py_INCREF(entry);
+        bool saved = saveEntry(db, collection, entry, (CBLConcurrencyControl)concurrency, &errors[i], &exception);
+        Py_DECREF(entry);
+        if (!saved && !appendFailure(failures, i, exception)) {
+            Py_CLEAR(failures);
+            break;
+        }
+    }
+    Py_DECREF(seq);
+    return failures;
+}
+
+
+// getDocuments(dbAddress, ids, decode, blobFactory, errorAddress) -> (results, failedIndex)
+static PyObject* native_getDocuments(PyObject *self, PyObject *args) {
+    PyObject *dbAddr, *ids, *blobFactory, *errorAddr;
+    int decode;
+    if (!PyArg_ParseTuple(args, "OOpOO:getDocuments", &dbAddr, &ids, &decode, &blobFactory, &errorAddr))
+        return NULL;
+    CBLDatabase *db = asPointer(dbAddr);
+    CBLError *error = asPointer(errorAddr);
+    if (!db || !error)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL database or error");
+    PyObject *seq = PySequence_Fast(ids, "ids must be a sequence");
+    if (!seq)
+        return NULL;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject *results = PyList_New(count);
+    if (!results) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    Py_ssize_t failedIndex = -1;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        Py_ssize_t size;
+        const char *id = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(seq, i), &size);
+        if (!id)
+            goto fail;
+        const CBLDocument *doc;
+        Py_BEGIN_ALLOW_THREADS
+        doc = CBLDatabase_GetDocument(db, (FLString){id, (size_t)size}, error);
+        Py_END_ALLOW_THREADS
+
+        PyObject *item;
+        if (!doc) {
+            if (error->code != 0) {
+                failedIndex = i;
+                break;
+            }
+            item = Py_None;
+            Py_INCREF(item);
+        } else if (decode) {
+            item = decodeValue((FLValue)CBLDocument_Properties(doc), blobFactory, NULL);
+            CBL_Release((void*)doc);
+            if (!item)
+                goto fail;
+        } else {
+            // Python takes over the reference to the document
+            item = PyLong_FromVoidPtr((void*)doc);
+            if (!item) {
+                CBL_Release((void*)doc);
+                goto fail;
+            }
+        }
+        PyList_SET_ITEM(results, i, item);
+    }
+    Py_DECREF(seq);
+    if (failedIndex >= 0) {
+        // Unfilled items are NULL; make the list safe to release
+        for (Py_ssize_t i = failedIndex; i < count; i++) {
+            Py_INCREF(Py_None);
+            PyList_SET_ITEM(results, i, Py_None);
+        }
+    }
+    return Py_BuildValue("(Nn)", results, failedIndex);
+
+fail:
+    Py_DECREF(seq);
+    Py_DECREF(results);
+    return NULL;
+}
+
+
+//////// QUERIES
+
+
+// A result column being accumulated by `executeColumnar`. It stays in a typed C buffer as long
+// as every value is an int, a double, or a boolean; ints are promoted to doubles if a double
+// shows up. Anything else (strings, collections, nulls, unsigned ints above INT64_MAX) switches
+// the column to a list of Python objects, converted from the buffer as they were stored.
+typedef enum {
+    kColumnEmpty,
+    kColumnInt,         // int64_t values
+    kColumnDouble,      // double values
+    kColumnBool,        // char values
+    kColumnObjects,     // PyList
+} ColumnKind;
+
+typedef struct {
+    ColumnKind kind;
+    char *buffer;
+    size_t count, capacity;     // in items
+    PyObject *list;
+} Column;
+
+
+static size_t itemSize(ColumnKind kind) {
+    return (kind == kColumnBool) ? sizeof(char) : sizeof(int64_t);
+}
+
+
+static bool growColumn(Column *col) {
+    if (col->count < col->capacity)
+        return true;
+    size_t capacity = col->capacity ? 2 * col->capacity : 1024;
+    char *buffer = realloc(col->buffer, capacity * sizeof(int64_t));
+    if (!buffer) {
+        PyErr_NoMemory();
+        return false;
+    }
+    col->buffer = buffer;
+    col->capacity = capacity;
+    return true;
+}
+
+
+// Converts a typed column to a list, once it gets a value that doesn't fit.
+static bool columnToObjects(Column *col) {
+    PyObject *list = PyList_New(col->count);
+    if (!list)
+        return false;
+    for (size_t i = 0; i < col->count; i++) {
+        PyObject *item;
+        switch (col->kind) {
+            case kColumnInt:    item = PyLong_FromLongLong(((int64_t*)col->buffer)[i]); break;
+            case kColumnDouble: item = PyFloat_FromDouble(((double*)col->buffer)[i]); break;
+            default:            item = PyBool_FromLong(col->buffer[i]); break;
+        }
+        if (!item) {
+            Py_DECREF(list);
+            return false;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    free(col->buffer);
+    col->buffer = NULL;
+    col->count = col->capacity = 0;
+    col->list = list;
+    col->kind = kColumnObjects;
+    return true;
+}
+
+
+static bool appendToColumn(Column *col, FLValue value, PyObject *blobFactory) {
+    FLValueType type = FLValue_GetType(value);
+    bool isInt = (type == kFLNumber && FLValue_IsInteger(value)
+                  && !(FLValue_IsUnsigned(value) && FLValue_AsUnsigned(value) > INT64_MAX));
+    if (col->kind == kColumnEmpty) {
+        if (isInt)
+            col->kind = kColumnInt;
+        else if (type == kFLNumber)
+            col->kind = kColumnDouble;
+        else if (type == kFLBoolean)
+            col->kind = kColumnBool;
+        else
+            col->kind = kColumnObjects;
+    } else if (col->kind == kColumnInt && type == kFLNumber && !FLValue_IsInteger(value)) {
+        // (A big unsigned int doesn't fit in a double either; it makes the ints objects below.)
+        for (size_t i = 0; i < col->count; i++)
+            ((double*)col->buffer)[i] = (double)((int64_t*)col->buffer)[i];
+        col->kind = kColumnDouble;
+    }
+
+    switch (col->kind) {
+        case kColumnInt:
+            if (!isInt)
+                break;
+            if (!growColumn(col))
+                return false;
+            ((int64_t*)col->buffer)[col->count++] = FLValue_AsInt(value);
+            return true;
+        case kColumnDouble:
+            if (type != kFLNumber || (FLValue_IsInteger(value) && !isInt))
+                break;
+            if (!growColumn(col))
+                return false;
+            ((double*)col->buffer)[col->count++] = FLValue_AsDouble(value);
+            return true;
+        case kColumnBool:
+            if (type != kFLBoolean)
+                break;
+            if (!growColumn(col))
+                return false;
+            col->buffer[col->count++] = FLValue_AsBool(value);
+            return true;
+        default:
+            break;
+    }
+
+    if (col->kind != kColumnObjects) {
+        if (!columnToObjects(col))
+            return false;
+    } else if (!col->list) {
+        col->list = PyList_New(0);
+        if (!col->list)
+            return false;
+    }
+    PyObject *item = decodeValue(value, blobFactory, NULL);
+    if (!item)
+        return false;
+    int result = PyList_Append(col->list, item);
+    Py_DECREF(item);
+    return result == 0;
+}
+
+
+// Returns the finished column as an `array.array`, or a list. Steals the column's contents.
+static PyObject* finishColumn(Column *col, PyObject *arrayType) {
+    if (col->kind == kColumnObjects) {
+        PyObject *list = col->list;
+        col->list = NULL;
+        return list;
+    } else if (col->kind == kColumnEmpty) {
+        return PyList_New(0);
+    }
+    const char *typecode = (col->kind == kColumnInt) ? "q" : (col->kind == kColumnDouble) ? "d" : "b";
+    PyObject *array = PyObject_CallFunction(arrayType, "s", typecode);
+    if (!array)
+        return NULL;
+    PyObject *memory = PyMemoryView_FromMemory(col->buffer, col->count * itemSize(col->kind),
+                                               PyBUF_READ);
+    PyObject *result = memory ? PyObject_CallMethod(array, "frombytes", "O", memory) : NULL;
+    Py_XDECREF(memory);
+    if (!result) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    Py_DECREF(result);
+    return array;
+}
+
+
+// executeColumnar(queryAddress, blobFactory, errorAddress) -> [column, ...] or None
+static PyObject* native_executeColumnar(PyObject *self, PyObject *args) {
+    PyObject *queryAddr, *blobFactory, *errorAddr;
+    if (!PyArg_ParseTuple(args, "OOO:executeColumnar", &queryAddr, &blobFactory, &errorAddr))
+        return NULL;
+    CBLQuery *query = asPointer(queryAddr);
+    CBLError *error = asPointer(errorAddr);
+    if (!query || !error)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL query or error");
+    PyObject *arrayModule = PyImport_ImportModule("array");
+    PyObject *arrayType = arrayModule ? PyObject_GetAttrString(arrayModule, "array") : NULL;
+    Py_XDECREF(arrayModule);
+    if (!arrayType)
+        return NULL;
+
+    unsigned nColumns = CBLQuery_ColumnCount(query);
+    Column *columns = calloc(nColumns ? nColumns : 1, sizeof(Column));
+    if (!columns) {
+        Py_DECREF(arrayType);
+        return PyErr_NoMemory();
+    }
+
+    PyObject *result = NULL;
+    CBLResultSet *rs;
+    Py_BEGIN_ALLOW_THREADS
+    rs = CBLQuery_Execute(query, error);
+    Py_END_ALLOW_THREADS
+    if (!rs) {
+        result = Py_None;
+        Py_INCREF(result);
+        goto done;
+    }
+    while (CBLResultSet_Next(rs)) {
+        for (unsigned c = 0; c < nColumns; c++) {
+            if (!appendToColumn(&columns[c], CBLResultSet_ValueAtIndex(rs, c), blobFactory))
+                goto done;
+        }
+    }
+    result = PyList_New(nColumns);
+    for (unsigned c = 0; result && c < nColumns; c++) {
+        PyObject *column = finishColumn(&columns[c], arrayType);
+        if (!column)
+            Py_CLEAR(result);
+        else
+            PyList_SET_ITEM(result, c, column);
+    }
+
+done:
+    CBL_Release(rs);
+    for (unsigned c = 0; c < nColumns; c++) {
+        free(columns[c].buffer);
+        Py_XDECREF(columns[c].list);
+    }
+    free(columns);
+    Py_DECREF(arrayType);
+    return result;
+}
+
+
+// Compares a query's results with the previous results, for live queries. Each row is identified
+// by the value of its column `keyColumn`, and fingerprinted by its Fleece encoding. Only new and
+// changed rows are decoded; an unchanged row reuses the tuple decoded last time.
+//
+// diffResults(resultSetAddress, keyColumn, previous, blobFactory)
+//     -> (rows, current, added, changed, removed)
+// `previous` and `current` map each key to (encoding, row). `rows` lists the rows as tuples, in
+// result order. `added`, `changed` and `removed` are lists of keys. If several rows have the
+// same key, only the first one is diffed.
+static PyObject* native_diffResults(PyObject *self, PyObject *args) {
+    PyObject *rsAddr, *previous, *blobFactory;
+    unsigned keyColumn;
+    if (!PyArg_ParseTuple(args, "OIO!O:diffResults", &rsAddr, &keyColumn, &PyDict_Type, &previous,
+                          &blobFactory))
+        return NULL;
+    CBLResultSet *rs = asPointer(rsAddr);
+    if (!rs)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL result set");
+
+    PyObject *rows = PyList_New(0), *current = PyDict_New();
+    PyObject *added = PyList_New(0), *changed = PyList_New(0), *removed = PyList_New(0);
+    FLEncoder enc = FLEncoder_New();
+    bool ok = rows && current && added && changed && removed && enc;
+    while (ok && CBLResultSet_Next(rs)) {
+        FLArray array = CBLResultSet_ResultArray(rs);
+        PyObject *key = decodeValue(FLArray_Get(array, keyColumn), blobFactory, NULL);
+        PyObject *encoding = NULL, *row = NULL, *entry = NULL;
+        ok = false;
+        if (!key)
+            goto nextRow;
+        FLEncoder_WriteValue(enc, (FLValue)array);
+        FLSliceResult data = FLEncoder_Finish(enc, NULL);
+        if (!data.buf) {
+            PyErr_NoMemory();
+            goto nextRow;
+        }
+        encoding = PyBytes_FromStringAndSize(data.buf, data.size);
+        FLSliceResult_Release(data);
+        if (!encoding)
+            goto nextRow;
+
+        int duplicate = PyDict_Contains(current, key);
+        if (duplicate < 0)
+            goto nextRow;
+        PyObject *old = duplicate ? NULL : PyDict_GetItemWithError(previous, key);     // borrowed
+        if (!old && PyErr_Occurred())
+            goto nextRow;
+        if (old && PyTuple_Check(old) && PyTuple_GET_SIZE(old) == 2) {
+            PyObject *oldEncoding = PyTuple_GET_ITEM(old, 0);
+            if (PyBytes_Check(oldEncoding) && PyBytes_GET_SIZE(oldEncoding) == (Py_ssize_t)data.size
+                    && memcmp(PyBytes_AS_STRING(oldEncoding), PyBytes_AS_STRING(encoding), data.size) == 0) {
+                row = PyTuple_GET_ITEM(old, 1);
+                Py_INCREF(row);
+            }
+        }
+        if (!row) {
+            PyObject *list = decodeArray(array, blobFactory, NULL);
+            row = list ? PyList_AsTuple(list) : NULL;
+            Py_XDECREF(list);
+            if (!row)
+                goto nextRow;
+            if (!duplicate && PyList_Append(old ? changed : added, key) < 0)
+                goto nextRow;
+        }
+        if (PyList_Append(rows, row) < 0)
+            goto nextRow;
+        if (!duplicate) {
+            entry = PyTuple_Pack(2, encoding, row);
+            if (!entry || PyDict_SetItem(current, key, entry) < 0)
+                goto nextRow;
+        }
+        ok = true;
+    nextRow:
+        Py_XDECREF(key);
+        Py_XDECREF(encoding);
+        Py_XDECREF(row);
+        Py_XDECREF(entry);
+    }
+    if (enc)
+        FLEncoder_Free(enc);
+
+    Py_ssize_t pos = 0;
+    PyObject *key, *value;
+    while (ok && PyDict_Next(previous, &pos, &key, &value)) {
+        int present = PyDict_Contains(current, key);
+        if (present < 0 || (!present && PyList_Append(removed, key) < 0))
+            ok = false;
+    }
+    if (!ok) {
+        if (!PyErr_Occurred())
+            PyErr_NoMemory();
+        Py_XDECREF(rows);
+        Py_XDECREF(current);
+        Py_XDECREF(added);
+        Py_XDECREF(changed);
+        Py_XDECREF(removed);
+        return NULL;
+    }
+    return Py_BuildValue("(NNNNN)", rows, current, added, changed, removed);
+}
+
+
+//////// JSON LINES
+
+
+// Returns the UTF-8 contents of a bytes, bytearray or str object.
+static bool getUTF8(PyObject *obj, FLSlice *out) {
+    if (PyBytes_Check(obj)) {
+        *out = (FLSlice){PyBytes_AS_STRING(obj), (size_t)PyBytes_GET_SIZE(obj)};
+    } else if (PyByteArray_Check(obj)) {
+        *out = (FLSlice){PyByteArray_AS_STRING(obj), (size_t)PyByteArray_GET_SIZE(obj)};
+    } else {
+        Py_ssize_t size;
+        const char *utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+        if (!utf8)
+            return false;
+        *out = (FLSlice){utf8, (size_t)size};
+    }
+    return true;
+}
+
+
+static bool isBlankLine(FLSlice line) {
+    for (size_t i = 0; i < line.size; i++) {
+        char c = ((const char*)line.buf)[i];
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            return false;
+    }
+    return true;
+}
+
+
+// Parses one JSON object and saves it as a document, whose ID is the value of the property
+// `idField` (if it's non-empty and the property is a string), else a random UUID.
+// Returns false on failure, with either `*outException` set or the CBL error in `*outError`.
+static bool importLine(CBLDatabase *db, FLSlice line, FLString idField, CBLConcurrencyControl concurrency,
+                       CBLError *outError, PyObject **outException)
+{
+    FLError flErr = kFLNoError;
+    bool saved = false, badJSON = false, badID = false;
+    Py_BEGIN_ALLOW_THREADS
+    FLMutableDict dict = FLMutableDict_NewFromJSON(line, &flErr);
+    if (!dict) {
+        badJSON = true;
+    } else {
+        FLValue idValue = idField.size ? FLDict_Get((FLDict)dict, idField) : NULL;
+        CBLDocument *doc = NULL;
+        if (!idValue)
+            doc = CBLDocument_Create();
+        else if (FLValue_GetType(idValue) == kFLString)
+            doc = CBLDocument_CreateWithID(FLValue_AsString(idValue));
+        else
+            badID = true;
+        if (doc) {
+            CBLDocument_SetProperties(doc, dict);
+            saved = CBLDatabase_SaveDocumentWithConcurrencyControl(db, doc, concurrency, outError);
+            CBL_Release(doc);
+        }
+        FLValue_Release((FLValue)dict);
+    }
+    Py_END_ALLOW_THREADS
+    if (badJSON) {
+        PyErr_Format(PyExc_ValueError, "Invalid JSON object (Fleece error %d)", (int)flErr);
+        *outException = takeException();
+    } else if (badID) {
+        PyErr_Format(PyExc_ValueError, "Document ID property \"%.*s\" is not a string",
+                     (int)idField.size, (const char*)idField.buf);
+        *outException = takeException();
+    }
+    return saved;
+}
+
+
+// importJSONLines(dbAddress, lines, idField, concurrency, errorsAddress) -> [(index, exception)]
+static PyObject* native_importJSONLines(PyObject *self, PyObject *args) {
+    PyObject *dbAddr, *lines, *idObj, *errorsAddr;
+    int concurrency;
+    if (!PyArg_ParseTuple(args, "OOOiO:importJSONLines", &dbAddr, &lines, &idObj, &concurrency, &errorsAddr))
+        return NULL;
+    CBLDatabase *db = asPointer(dbAddr);
+    CBLError *errors = asPointer(errorsAddr);
+    if (!db || !errors)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL database or error array");
+    FLSlice idField = {NULL, 0};
+    if (idObj != Py_None && !getUTF8(idObj, &idField))
+        return NULL;
+    PyObject *seq = PySequence_Fast(lines, "lines must be a sequence");
+    if (!seq)
+        return NULL;
+    PyObject *failures = PyList_New(0);
+    if (!failures) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        FLSlice line;
+        PyObject *exception = NULL;
+        if (!getUTF8(PySequence_Fast_GET_ITEM(seq, i), &line)) {
+            exception = takeException();
+        } else if (isBlankLine(line)) {
+            continue;
+        } else if (importLine(db, line, idField, (CBLConcurrencyControl)concurrency, &errors[i], &exception)) {
+            continue;
+        }
+        if (!appendFailure(failures, i, exception)) {
+            Py_CLEAR(failures);
+            break;
+        }
+    }
+    Py_DECREF(seq);
+    return failures;
+}
+
+
+// Accumulates output and passes it to a Python `write` function in chunks of about kChunkSize.
+// After each chunk, `progress` (unless it's None) is called with the number of lines written.
+typedef struct {
+    PyObject *write, *progress;
+    char *buffer;
+    size_t length, capacity;
+    long long lines, written;       // lines in `buffer`, and lines already written
+} ChunkWriter;
+
+#define kChunkSize (1024 * 1024)
+
+static bool flushChunk(ChunkWriter *w) {
+    if (w->length == 0)
+        return true;
+    PyObject *result = PyObject_CallFunction(w->write, "y#", w->buffer, (Py_ssize_t)w->length);
+    w->length = 0;
+    w->written += w->lines;
+    w->lines = 0;
+    if (result && w->progress != Py_None) {
+        Py_DECREF(result);
+        result = PyObject_CallFunction(w->progress, "L", w->written);
+    }
+    Py_XDECREF(result);
+    return result != NULL;
+}
+
+static bool writeLine(ChunkWriter *w, FLSlice json) {
+    if (w->length + json.size + 1 > w->capacity) {
+        if (!flushChunk(w))
+            return false;
+        if (json.size + 1 > w->capacity) {
+            size_t capacity = (json.size + 1 > kChunkSize) ? json.size + 1 : kChunkSize;
+            char *buffer = realloc(w->buffer, capacity);
+            if (!buffer) {
+                PyErr_NoMemory();
+                return false;
+            }
+            w->buffer = buffer;
+            w->capacity = capacity;
+        }
+    }
+    memcpy(w->buffer + w->length, json.buf, json.size);
+    w->length += json.size;
+    w->buffer[w->length++] = '\n';
+    ++w->lines;
+    return true;
+}
+
+
+// Encodes a document's properties as JSON, adding its ID as the property `idField` if that's
+// non-empty.
+static FLSliceResult documentJSON(FLDict props, FLString docID, FLString idField, FLEncoder enc) {
+    if (idField.size == 0)
+        return FLValue_ToJSON((FLValue)props);
+    FLEncoder_BeginDict(enc, FLDict_Count(props) + 1);
+    FLEncoder_WriteKey(enc, idField);
+    FLEncoder_WriteString(enc, docID);
+    FLDictIterator i;
+    FLDictIterator_Begin(props, &i);
+    FLValue value;
+    while (NULL != (value = FLDictIterator_GetValue(&i))) {
+        FLString key = FLDictIterator_GetKeyString(&i);
+        if (!FLSlice_Equal(key, idField)) {
+            FLEncoder_WriteKey(enc, key);
+            FLEncoder_WriteValue(enc, value);
+        }
+        FLDictIterator_Next(&i);
+    }
+    FLEncoder_EndDict(enc);
+    return FLEncoder_Finish(enc, NULL);
+}
+
+
+// exportJSONLines(queryAddress, documents, idField, write, progress, errorAddress) -> count or -1
+static PyObject* native_exportJSONLines(PyObject *self, PyObject *args) {
+    PyObject *queryAddr, *idObj, *write, *progress, *errorAddr;
+    int documents;
+    if (!PyArg_ParseTuple(args, "OpOOOO:exportJSONLines", &queryAddr, &documents, &idObj, &write,
+                          &progress, &errorAddr))
+        return NULL;
+    CBLQuery *query = asPointer(queryAddr);
+    CBLError *error = asPointer(errorAddr);
+    if (!query || !error)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL query or error");
+    FLSlice idField = {NULL, 0};
+    if (PyErr_Occurred() || (idObj != Py_None && !getUTF8(idObj, &idField)))
+        return NULL;
+
+    CBLResultSet *rs;
+    Py_BEGIN_ALLOW_THREADS
+    rs = CBLQuery_Execute(query, error);
+    Py_END_ALLOW_THREADS
+    if (!rs)
+        return PyLong_FromLong(-1);
+
+    ChunkWriter writer = {write, progress, NULL, 0, 0, 0, 0};
+    FLEncoder enc = (documents && idField.size) ? FLEncoder_NewWithOptions(kFLEncodeJSON, 0, false) : NULL;
+    long long count = 0;
+    bool ok = true;
+    while (ok && CBLResultSet_Next(rs)) {
+        FLSliceResult json;
+        if (documents) {
+            // Each row is a document ID and its properties, from the one query, so the export
+            // is a snapshot and needs no extra lookups
+            json = documentJSON(FLValue_AsDict(CBLResultSet_ValueAtIndex(rs, 1)),
+                                FLValue_AsString(CBLResultSet_ValueAtIndex(rs, 0)), idField, enc);
+        } else {
+            json = FLValue_ToJSON((FLValue)CBLResultSet_ResultDict(rs));
+        }
+        ok = writeLine(&writer, (FLSlice){json.buf, json.size});
+        FLSliceResult_Release(json);
+        ++count;
+    }
+    if (ok)
+        ok = flushChunk(&writer);
+    CBL_Release(rs);
+    free(writer.buffer);
+    if (enc)
+        FLEncoder_Free(enc);
+    if (!ok)
+        return NULL;
+    return PyLong_FromLongLong(count);
+}
+
+
+//////// KEY PATHS
+
+
+// Compiled FLKeyPaths, keyed by their specifier string, as capsules that free them. Callers keep
+// a reference to the capsule while they use the key path, since the cache may be cleared.
+static PyObject *sKeyPaths;
+
+#define kMaxKeyPaths 1024
+
+static const char *kKeyPathName = "CBLForPython.FLKeyPath";
+
+static void freeKeyPath(PyObject *capsule) {
+    FLKeyPath_Free(PyCapsule_GetPointer(capsule, kKeyPathName));
+}
+
+// Returns a new reference to the capsule holding the compiled key path `path` (a str).
+static PyObject* compiledKeyPath(PyObject *path) {
+    if (!sKeyPaths && !(sKeyPaths = PyDict_New()))
+        return NULL;
+    PyObject *capsule = PyDict_GetItemWithError(sKeyPaths, path);
+    if (capsule) {
+        Py_INCREF(capsule);
+        return capsule;
+    } else if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_ssize_t size;
+    const char *spec = PyUnicode_AsUTF8AndSize(path, &size);
+    if (!spec)
+        return NULL;
+    FLError flErr = kFLNoError;
+    FLKeyPath keyPath = FLKeyPath_New((FLSlice){spec, (size_t)size}, &flErr);
+    if (!keyPath)
+        return PyErr_Format(PyExc_ValueError, "Invalid key path \"%U\" (Fleece error %d)", path, (int)flErr);
+    capsule = PyCapsule_New(keyPath, kKeyPathName, freeKeyPath);
+    if (!capsule) {
+        FLKeyPath_Free(keyPath);
+        return NULL;
+    }
+    if (PyDict_GET_SIZE(sKeyPaths) >= kMaxKeyPaths)
+        PyDict_Clear(sKeyPaths);
+    if (PyDict_SetItem(sKeyPaths, path, capsule) < 0) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    return capsule;
+}
+
+
+// evalKeyPath(address, path, blobFactory, missing) -> value
+static PyObject* native_evalKeyPath(PyObject *self, PyObject *args) {
+    PyObject *addr, *path, *blobFactory, *missing;
+    if (!PyArg_ParseTuple(args, "OUOO:evalKeyPath", &addr, &path, &blobFactory, &missing))
+        return NULL;
+    FLValue root = asPointer(addr);
+    if (PyErr_Occurred())
+        return NULL;
+    PyObject *capsule = compiledKeyPath(path);
+    if (!capsule)
+        return NULL;
+    FLValue value = FLKeyPath_Eval(PyCapsule_GetPointer(capsule, kKeyPathName), root);
+    Py_DECREF(capsule);
+    if (!value) {
+        Py_INCREF(missing);
+        return missing;
+    }
+    return decodeValue(value, blobFactory, NULL);
+}
+
+
+// project(dbAddress, collectionAddress, ids, paths, blobFactory, missing, errorAddress)
+//      -> (rows, failedIndex)
+static PyObject* native_project(PyObject *self, PyObject *args) {
+    PyObject *dbAddr, *collectionAddr, *ids, *paths, *blobFactory, *missing, *errorAddr;
+    if (!PyArg_ParseTuple(args, "OOOOOOO:project", &dbAddr, &collectionAddr, &ids, &paths,
+                          &blobFactory, &missing, &errorAddr))
+        return NULL;
+    CBLDatabase *db = asPointer(dbAddr);
+    CBLCollection *collection = asPointer(collectionAddr);
+    CBLError *error = asPointer(errorAddr);
+    if (PyErr_Occurred())
+        return NULL;
+    if ((!db && !collection) || !error)
+        return PyErr_Format(PyExc_ValueError, "NULL database or error");
+
+    PyObject *pathSeq = NULL, *idSeq = NULL, *capsules = NULL, *results = NULL;
+    FLKeyPath *keyPaths = NULL;
+    Py_ssize_t failedIndex = -1;
+
+    // Compile (or look up) all the key paths up front:
+    pathSeq = PySequence_Fast(paths, "paths must be a sequence");
+    if (!pathSeq)
+        goto fail;
+    Py_ssize_t nPaths = PySequence_Fast_GET_SIZE(pathSeq);
+    capsules = PyList_New(0);       // keeps the compiled key paths alive until we're done
+    keyPaths = PyMem_Malloc((nPaths ? nPaths : 1) * sizeof(FLKeyPath));
+    if (!capsules || !keyPaths) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    for (Py_ssize_t p = 0; p < nPaths; p++) {
+        PyObject *path = PySequence_Fast_GET_ITEM(pathSeq, p);
+        if (!PyUnicode_Check(path)) {
+            PyErr_SetString(PyExc_TypeError, "key paths must be strings");
+            goto fail;
+        }
+        PyObject *capsule = compiledKeyPath(path);
+        if (!capsule)
+            goto fail;
+        int appended = PyList_Append(capsules, capsule);
+        Py_DECREF(capsule);
+        if (appended < 0)
+            goto fail;
+        keyPaths[p] = PyCapsule_GetPointer(capsule, kKeyPathName);
+    }
+
+    idSeq = PySequence_Fast(ids, "ids must be a sequence");
+    if (!idSeq)
+        goto fail;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(idSeq);
+    results = PyList_New(count);
+    if (!results)
+        goto fail;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        Py_INCREF(Py_None);
+        PyList_SET_ITEM(results, i, Py_None);
+    }
+
+    for (Py_ssize_t i = 0; i < count; i++) {
+        Py_ssize_t size;
+        const char *id = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(idSeq, i), &size);
+        if (!id)
+            goto fail;
+        const CBLDocument *doc;
+        Py_BEGIN_ALLOW_THREADS
+        if (collection)
+            doc = CBLCollection_GetDocument(collection, (FLString){id, (size_t)size}, error);
+        else
+            doc = CBLDatabase_GetDocument(db, (FLString){id, (size_t)size}, error);
+        Py_END_ALLOW_THREADS
+        if (!doc) {
+            if (error->code != 0) {
+                failedIndex = i;
+                break;
+            }
+            continue;
+        }
+        FLValue root = (FLValue)CBLDocument_Properties(doc);
+        PyObject *row = PyTuple_New(nPaths);
+        for (Py_ssize_t p = 0; row && p < nPaths; p++) {
+            FLValue value = FLKeyPath_Eval(keyPaths[p], root);
+            PyObject *item;
+            if (value) {
+                item = decodeValue(value, blobFactory, NULL);
+            } else {
+                item = missing;
+                Py_INCREF(item);
+            }
+            if (!item)
+                Py_CLEAR(row);
+            else
+                PyTuple_SET_ITEM(row, p, item);
+        }
+        CBL_Release((void*)doc);
+        if (!row)
+            goto fail;
+        PyList_SetItem(results, i, row);
+    }
+    Py_DECREF(pathSeq);
+    Py_DECREF(idSeq);
+    Py_DECREF(capsules);
+    PyMem_Free(keyPaths);
+    return Py_BuildValue("(Nn)", results, failedIndex);
+
+fail:
+    Py_XDECREF(pathSeq);
+    Py_XDECREF(idSeq);
+    Py_XDECREF(capsules);
+    Py_XDECREF(results);
+    PyMem_Free(keyPaths);
+    return NULL;
+}
+
+
+//////// REPLICATION FILTERS
+
+
+// A replication filter made of declarative rules, which the replicator's thread evaluates without
+// touching Python. A document passes if every rule does; then, if there's a callback (such as a
+// Python filter function), it gets the final say. Compiled filters are immutable, so they're safe
+// to call on any thread.
+typedef enum {
+    kRuleDocIDs,        // `values` is a dict whose keys are the doc IDs
+    kRuleIDPrefix,      // `values` is an array of prefix strings
+    kRuleEquals,        // `values` is the value the property at `path` must equal
+    kRuleIn,            // `values` is an array of values the property at `path` must equal one of
+    kRuleExists,        // the property at `path` must exist
+    kRuleDeleted,       // the document's deleted flag must equal `flag`
+} RuleKind;
+
+typedef struct {
+    RuleKind kind;
+    bool negate;
+    bool flag;
+    FLKeyPath path;
+    FLDoc values;
+} FilterRule;
+
+typedef struct {
+    FilterRule *rules;
+    size_t count;
+    bool passDeletions;                 // deleted/removed docs pass without checking the rules
+    CBLReplicationFilter callback;
+    void *callbackContext;
+} ReplicationFilter;
+
+// The `context` of a CBLReplicatorConfiguration, which is shared by its push and pull filters.
+typedef struct {
+    PyObject *push, *pull;              // ReplicationFilter capsules, or NULL
+    ReplicationFilter *pushFilter, *pullFilter;
+} ReplicationFilterPair;
+
+#define kDocumentFlagsDeleted       1   // kCBLDocumentFlagsDeleted
+#define kDocumentFlagsAccessRemoved 2   // kCBLDocumentFlagsAccessRemoved
+
+static const char *kReplicationFilterName = "CBLForPython.ReplicationFilter";
+static const char *kReplicationFilterPairName = "CBLForPython.ReplicationFilterPair";
+
+
+static bool rulePasses(const FilterRule *rule, const CBLDocument *doc, CBLDocumentFlags flags) {
+    FLValue root = rule->values ? FLDoc_GetRoot(rule->values) : NULL;
+    switch (rule->kind) {
+        case kRuleDocIDs:
+            return FLDict_Get(FLValue_AsDict(root), CBLDocument_ID(doc)) != NULL;
+        case kRuleIDPrefix: {
+            FLString docID = CBLDocument_ID(doc);
+            FLArray prefixes = FLValue_AsArray(root);
+            uint32_t n = FLArray_Count(prefixes);
+            for (uint32_t i = 0; i < n; i++) {
+                FLString prefix = FLValue_AsString(FLArray_Get(prefixes, i));
+                if (prefix.size <= docID.size && memcmp(prefix.buf, docID.buf, prefix.size) == 0)
+                    return true;
+            }
+            return false;
+        }
+        case kRuleEquals: {
+            FLValue value = FLKeyPath_Eval(rule->path, (FLValue)CBLDocument_Properties(doc));
+            return value && FLValue_IsEqual(value, root);
+        }
+        case kRuleIn: {
+            FLValue value = FLKeyPath_Eval(rule->path, (FLValue)CBLDocument_Properties(doc));
+            if (!value)
+                return false;
+            FLArray candidates = FLValue_AsArray(root);
+            uint32_t n = FLArray_Count(candidates);
+            for (uint32_t i = 0; i < n; i++) {
+                if (FLValue_IsEqual(value, FLArray_Get(candidates, i)))
+                    return true;
+            }
+            return false;
+        }
+        case kRuleExists:
+            return FLKeyPath_Eval(rule->path, (FLValue)CBLDocument_Properties(doc)) != NULL;
+        case kRuleDeleted:
+            return ((flags & kDocumentFlagsDeleted) != 0) == rule->flag;
+    }
+    return false;
+}
+
+static bool filterPasses(const ReplicationFilter *filter, CBLDocument *doc, CBLDocumentFlags flags) {
+    if (filter->passDeletions && (flags & (kDocumentFlagsDeleted | kDocumentFlagsAccessRemoved)))
+        return true;
+    for (size_t i = 0; i < filter->count; i++) {
+        const FilterRule *rule = &filter->rules[i];
+        if (rulePasses(rule, doc, flags) == rule->negate)
+            return false;
+    }
+    return !filter->callback || filter->callback(filter->callbackContext, doc, flags);
+}
+
+// CBLReplicationFilters for a ReplicationFilterPair context. They run on the replicator's thread
+// without the GIL, and don't touch Python objects (unless a callback does.)
+static bool pushReplicationFilter(void *context, CBLDocument *doc, CBLDocumentFlags flags) {
+    return filterPasses(((ReplicationFilterPair*)context)->pushFilter, doc, flags);
+}
+
+static bool pullReplicationFilter(void *context, CBLDocument *doc, CBLDocumentFlags flags) {
+    return filterPasses(((ReplicationFilterPair*)context)->pullFilter, doc, flags);
+}
+
+
+static void destroyReplicationFilter(ReplicationFilter *filter) {
+    for (size_t i = 0; i < filter->count; i++) {
+        if (filter->rules[i].path)
+            FLKeyPath_Free(filter->rules[i].path);
+        FLDoc_Release(filter->rules[i].values);
+    }
+    free(filter->rules);
+    free(filter);
+}
+
+static void freeReplicationFilter(PyObject *capsule) {
+    destroyReplicationFilter(PyCapsule_GetPointer(capsule, kReplicationFilterName));
+}
+
+static void freeReplicationFilterPair(PyObject *capsule) {
+    ReplicationFilterPair *pair = PyCapsule_GetPointer(capsule, kReplicationFilterPairName);
+    Py_XDECREF(pair->push);
+    Py_XDECREF(pair->pull);
+    free(pair);
+}
+
+
+// Compiles one `(kind, negate, path, value)` rule. `path` is a key path string or None; `value`
+// is encoded to Fleece unless it's None and the rule takes no value. (An `equals` rule's None
+// is a Fleece null, which matches a JSON null property.)
+static bool compileRule(PyObject *spec, FilterRule *rule) {
+    int kind, negate;
+    PyObject *path, *value;
+    if (!PyArg_ParseTuple(spec, "ipOO:compileRule", &kind, &negate, &path, &value))
+        return false;
+    if (kind < kRuleDocIDs || kind > kRuleDeleted) {
+        PyErr_Format(PyExc_ValueError, "Unknown replication filter rule %d", kind);
+        return false;
+    }
+    rule->kind = kind;
+    rule->negate = negate;
+    if (kind == kRuleDeleted) {
+        int flag = PyObject_IsTrue(value);
+        if (flag < 0)
+            return false;
+        rule->flag = flag;
+        return true;
+    }
+    if (kind == kRuleEquals || kind == kRuleIn || kind == kRuleExists) {
+        FLSlice spec;
+        if (path == Py_None || !getUTF8(path, &spec)) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError, "Replication filter rule needs a key path");
+            return false;
+        }
+        FLError flErr = kFLNoError;
+        rule->path = FLKeyPath_New(spec, &flErr);
+        if (!rule->path) {
+            PyErr_Format(PyExc_ValueError, "Invalid key path \"%S\" (Fleece error %d)", path, (int)flErr);
+            return false;
+        }
+    }
+    if (value != Py_None || kind == kRuleEquals) {
+        FLEncoder enc = FLEncoder_New();
+        if (encodeToEncoder(enc, value)) {
+            FLError flErr;
+            rule->values = FLEncoder_FinishDoc(enc, &flErr);
+            if (!rule->values)
+                PyErr_Format(PyExc_ValueError, "Fleece encoder error %d", (int)flErr);
+        }
+        FLEncoder_Free(enc);
+        if (!rule->values)
+            return false;
+    }
+    return true;
+}
+
+
+// newReplicationFilter(rules, passDeletions, callbackAddress, callbackContextAddress) -> capsule
+static PyObject* native_newReplicationFilter(PyObject *self, PyObject *args) {
+    PyObject *rules, *callbackAddr, *contextAddr;
+    int passDeletions;
+    if (!PyArg_ParseTuple(args, "OpOO:newReplicationFilter", &rules, &passDeletions,
+                          &callbackAddr, &contextAddr))
+        return NULL;
+    void *callback = asPointer(callbackAddr);
+    void *callbackContext = asPointer(contextAddr);
+    if (PyErr_Occurred())
+        return NULL;
+    PyObject *ruleSeq = PySequence_Fast(rules, "rules must be a sequence");
+    if (!ruleSeq)
+        return NULL;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(ruleSeq);
+    ReplicationFilter *filter = calloc(1, sizeof(ReplicationFilter));
+    if (filter)
+        filter->rules = calloc(count ? count : 1, sizeof(FilterRule));
+    if (!filter || !filter->rules) {
+        free(filter);
+        Py_DECREF(ruleSeq);
+        return PyErr_NoMemory();
+    }
+    filter->passDeletions = passDeletions;
+    filter->callback = (CBLReplicationFilter)callback;
+    filter->callbackContext = callbackContext;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        filter->count = i + 1;      // so a partly-compiled rule gets freed
+        if (!compileRule(PySequence_Fast_GET_ITEM(ruleSeq, i), &filter->rules[i])) {
+            Py_DECREF(ruleSeq);
+            destroyReplicationFilter(filter);
+            return NULL;
+        }
+    }
+    Py_DECREF(ruleSeq);
+    PyObject *capsule = PyCapsule_New(filter, kReplicationFilterName, freeReplicationFilter);
+    if (!capsule)
+        destroyReplicationFilter(filter);
+    return capsule;
+}
+
+
+// replicationFilterMatches(filter, docAddress, flags) -> bool
+static PyObject* native_replicationFilterMatches(PyObject *self, PyObject *args) {
+    PyObject *capsule, *docAddr;
+    unsigned flags;
+    if (!PyArg_ParseTuple(args, "OOI:replicationFilterMatches", &capsule, &docAddr, &flags))
+        return NULL;
+    ReplicationFilter *filter = PyCapsule_GetPointer(capsule, kReplicationFilterName);
+    CBLDocument *doc = asPointer(docAddr);
+    if (!filter || !doc)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL document");
+    return PyBool_FromLong(filterPasses(filter, doc, flags));
+}
+
+
+// newReplicationFilterPair(push, pull) -> (capsule, contextAddress, pushAddress, pullAddress)
+static PyObject* native_newReplicationFilterPair(PyObject *self, PyObject *args) {
+    PyObject *push, *pull;
+    if (!PyArg_ParseTuple(args, "OO:newReplicationFilterPair", &push, &pull))
+        return NULL;
+    if ((push != Py_None && !PyCapsule_IsValid(push, kReplicationFilterName))
+            || (pull != Py_None && !PyCapsule_IsValid(pull, kReplicationFilterName)))
+        return PyErr_Format(PyExc_TypeError, "Expected ReplicationFilter capsules or None");
+    ReplicationFilterPair *pair = calloc(1, sizeof(ReplicationFilterPair));
+    if (!pair)
+        return PyErr_NoMemory();
+    PyObject *capsule = PyCapsule_New(pair, kReplicationFilterPairName, freeReplicationFilterPair);
+    if (!capsule) {
+        free(pair);
+        return NULL;
+    }
+    if (push != Py_None) {
+        Py_INCREF(push);
+        pair->push = push;
+        pair->pushFilter = PyCapsule_GetPointer(push, kReplicationFilterName);
+    }
+    if (pull != Py_None) {
+        Py_INCREF(pull);
+        pair->pull = pull;
+        pair->pullFilter = PyCapsule_GetPointer(pull, kReplicationFilterName);
+    }
+    return Py_BuildValue("(NNNN)", capsule, PyLong_FromVoidPtr(pair),
+                         PyLong_FromVoidPtr(pair->push ? (void*)pushReplicationFilter : NULL),
+                         PyLong_FromVoidPtr(pair->pull ? (void*)pullReplicationFilter : NULL));
+}
+
+
+//////// REPLICATION EVENTS
+
+
+// Collects a replicator's document-replication events natively, so that a burst of them costs
+// one call into Python instead of one per CBL callback. Every event is counted, per collection;
+// while `keepEvents` is set they're also queued, up to `capacity` of them, beyond which new
+// ones are counted as dropped rather than blocking the replicator. Like ChangeBuffer, the CBL
+// callback runs without the GIL and only takes `mutex`.
+typedef struct {
+    FLSliceResult scope, name;
+    uint64_t pushed, pulled, errors;
+} CollectionCounts;
+
+typedef struct {
+    FLSliceResult docID;
+    size_t collection;              // index into ReplicationEventQueue.collections
+    CBLDocumentFlags flags;
+    bool isPush;
+    CBLErrorDomain errorDomain;
+    int errorCode;
+} ReplicationEvent;
+
+typedef struct {
+    CBLReplicator *replicator;
+    CBLListenerToken *token;
+    PyThread_type_lock mutex;       // protects the fields below
+    PyThread_type_lock ready;       // held except while events are waiting to be taken
+    bool signaled;
+    bool keepEvents;
+    ReplicationEvent *events;       // ring buffer
+    size_t capacity, head, count;
+    uint64_t dropped;
+    CollectionCounts *collections;
+    size_t collectionCount;
+} ReplicationEventQueue;
+
+static const char *kReplicationEventQueueName = "CBLForPython.ReplicationEventQueue";
+
+
+static FLString orDefault(FLString name) {
+    return name.buf ? name : (FLString){"_default", 8};
+}
+
+// Returns the index of a collection's counts, adding it if necessary, or SIZE_MAX if out of
+// memory. Must be called with `mutex` held. (Replicators have a handful of collections.)
+static size_t collectionIndex(ReplicationEventQueue *q, FLString scope, FLString name) {
+    scope = orDefault(scope);
+    name = orDefault(name);
+    for (size_t i = 0; i < q->collectionCount; i++) {
+        CollectionCounts *c = &q->collections[i];
+        if (FLSlice_Equal((FLSlice){c->name.buf, c->name.size}, name)
+                && FLSlice_Equal((FLSlice){c->scope.buf, c->scope.size}, scope))
+            return i;
+    }
+    CollectionCounts *collections = realloc(q->collections, (q->collectionCount + 1) * sizeof(CollectionCounts));
+    if (!collections)
+        return SIZE_MAX;
+    q->collections = collections;
+    collections[q->collectionCount] = (CollectionCounts){FLSlice_Copy(scope), FLSlice_Copy(name), 0, 0, 0};
+    return q->collectionCount++;
+}
+
+
+// CBLDocumentReplicationListener; called on the replicator's thread.
+static void replicationEventListener(void *context, CBLReplicator *replicator, bool isPush,
+                                     unsigned numDocuments, const CBLReplicatedDocument *documents)
+{
+    ReplicationEventQueue *q = context;
+    PyThread_acquire_lock(q->mutex, WAIT_LOCK);
+    bool queued = false;
+    for (unsigned i = 0; i < numDocuments; i++) {
+        const CBLReplicatedDocument *doc = &documents[i];
+        size_t index = collectionIndex(q, doc->scope, doc->collection);
+        if (index != SIZE_MAX) {
+            CollectionCounts *counts = &q->collections[index];
+            if (doc->error.code != 0)
+                counts->errors++;
+            else if (isPush)
+                counts->pushed++;
+            else
+                counts->pulled++;
+        }
+        if (!q->keepEvents)
+            continue;
+        if (q->count == q->capacity || index == SIZE_MAX) {
+            q->dropped++;
+            continue;
+        }
+        q->events[(q->head + q->count++) % q->capacity] = (ReplicationEvent){
+            FLSlice_Copy(doc->ID), index, doc->flags, isPush, doc->error.domain, doc->error.code};
+        queued = true;
+    }
+    if (queued && !q->signaled) {
+        q->signaled = true;
+        PyThread_release_lock(q->ready);
+    }
+    PyThread_release_lock(q->mutex);
+}
+
+
+static void signalEventQueue(ReplicationEventQueue *q) {
+    PyThread_acquire_lock(q->mutex, WAIT_LOCK);
+    if (!q->signaled) {
+        q->signaled = true;
+        PyThread_release_lock(q->ready);
+    }
+    PyThread_release_lock(q->mutex);
+}
+
+
+static void destroyReplicationEventQueue(ReplicationEventQueue *q) {
+    if (q->replicator) {
+        CBLListener_Remove(q->token);
+        CBL_Release(q->replicator);
+    }
+    for (size_t i = 0; i < q->count; i++)
+        FLSliceResult_Release(q->events[(q->head + i) % q->capacity].docID);
+    free(q->events);
+    for (size_t i = 0; i < q->collectionCount; i++) {
+        FLSliceResult_Release(q->collections[i].scope);
+        FLSliceResult_Release(q->collections[i].name);
+    }
+    free(q->collections);
+    if (q->ready) {
+        if (!q->signaled)
+            PyThread_release_lock(q->ready);
+        PyThread_free_lock(q->ready);
+    }
+    if (q->mutex)
+        PyThread_free_lock(q->mutex);
+    free(q);
+}
+
+static void freeReplicationEventQueue(PyObject *capsule) {
+    destroyReplicationEventQueue(PyCapsule_GetPointer(capsule, kReplicationEventQueueName));
+}
+
+
+// newReplicationEventQueue(replicatorAddress, capacity) -> capsule
+static PyObject* native_newReplicationEventQueue(PyObject *self, PyObject *args) {
+    PyObject *replAddr;
+    Py_ssize_t capacity;
+    if (!PyArg_ParseTuple(args, "On:newReplicationEventQueue", &replAddr, &capacity))
+        return NULL;
+    CBLReplicator *replicator = asPointer(replAddr);
+    if (!replicator)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL replicator");
+    if (capacity < 1)
+        return PyErr_Format(PyExc_ValueError, "Event queue capacity must be positive");
+    ReplicationEventQueue *q = calloc(1, sizeof(ReplicationEventQueue));
+    if (!q)
+        return PyErr_NoMemory();
+    q->capacity = (size_t)capacity;
+    q->events = calloc(q->capacity, sizeof(ReplicationEvent));
+    q->mutex = PyThread_allocate_lock();
+    q->ready = PyThread_allocate_lock();
+    if (!q->events || !q->mutex || !q->ready) {
+        q->signaled = true;         // i.e. `ready` isn't held
+        destroyReplicationEventQueue(q);
+        return PyErr_NoMemory();
+    }
+    PyThread_acquire_lock(q->ready, WAIT_LOCK);
+    PyObject *capsule = PyCapsule_New(q, kReplicationEventQueueName, freeReplicationEventQueue);
+    if (!capsule) {
+        destroyReplicationEventQueue(q);
+        return NULL;
+    }
+    q->replicator = (CBLReplicator*)CBL_Retain(replicator);
+    q->token = CBLReplicator_AddDocumentReplicationListener(replicator, replicationEventListener, q);
+    return capsule;
+}
+
+
+// keepReplicationEvents(queue, keep)
+static PyObject* native_keepReplicationEvents(PyObject *self, PyObject *args) {
+    PyObject *capsule;
+    int keep;
+    if (!PyArg_ParseTuple(args, "Op:keepReplicationEvents", &capsule, &keep))
+        return NULL;
+    ReplicationEventQueue *q = PyCapsule_GetPointer(capsule, kReplicationEventQueueName);
+    if (!q)
+        return NULL;
+    PyThread_acquire_lock(q->mutex, WAIT_LOCK);
+    q->keepEvents = keep;
+    PyThread_release_lock(q->mutex);
+    Py_RETURN_NONE;
+}
+
+
+// Returns "scope.name" for a collection's counts.
+static PyObject* collectionFullName(const CollectionCounts *c) {
+    return PyUnicode_FromFormat("%.*s.%.*s", (int)c->scope.size, (const char*)c->scope.buf,
+                                (int)c->name.size, (const char*)c->name.buf);
+}
+
+
+// waitForReplicationEvents(queue, timeout, maxEvents)
+//      -> [(docID, isPush, flags, collection, errorDomain, errorCode)]
+static PyObject* native_waitForReplicationEvents(PyObject *self, PyObject *args) {
+    PyObject *capsule;
+    double timeout;
+    Py_ssize_t maxEvents;
+    if (!PyArg_ParseTuple(args, "Odn:waitForReplicationEvents", &capsule, &timeout, &maxEvents))
+        return NULL;
+    ReplicationEventQueue *q = PyCapsule_GetPointer(capsule, kReplicationEventQueueName);
+    if (!q)
+        return NULL;
+    PY_TIMEOUT_T micros = (timeout < 0) ? -1 : (PY_TIMEOUT_T)(timeout * 1e6);
+    PyLockStatus status;
+    Py_BEGIN_ALLOW_THREADS
+    status = PyThread_acquire_lock_timed(q->ready, micros, 0);
+    Py_END_ALLOW_THREADS
+
+    PyThread_acquire_lock(q->mutex, WAIT_LOCK);
+    if (status == PY_LOCK_ACQUIRED)
+        q->signaled = false;
+    size_t n = q->count;
+    if (maxEvents > 0 && n > (size_t)maxEvents)
+        n = (size_t)maxEvents;
+    PyObject *events = PyList_New((Py_ssize_t)n);
+    PyObject *names = PyList_New((Py_ssize_t)q->collectionCount);
+    for (size_t i = 0; names && i < q->collectionCount; i++) {
+        PyObject *name = collectionFullName(&q->collections[i]);
+        if (!name)
+            Py_CLEAR(names);
+        else
+            PyList_SET_ITEM(names, i, name);
+    }
+    if (events && names) {
+        for (size_t i = 0; i < n; i++) {
+            ReplicationEvent *e = &q->events[(q->head + i) % q->capacity];
+            PyObject *event = Py_BuildValue("(s#OIOii)", (const char*)e->docID.buf,
+                                            (Py_ssize_t)e->docID.size,
+                                            e->isPush ? Py_True : Py_False, (unsigned)e->flags,
+                                            PyList_GET_ITEM(names, e->collection),
+                                            (int)e->errorDomain, e->errorCode);
+            if (!event) {
+                Py_CLEAR(events);
+                break;
+            }
+            PyList_SET_ITEM(events, i, event);
+        }
+    }
+    if (events) {
+        // Only dequeue the events if they made it into the list:
+        for (size_t i = 0; i < n; i++)
+            FLSliceResult_Release(q->events[(q->head + i) % q->capacity].docID);
+        q->head = (q->head + n) % q->capacity;
+        q->count -= n;
+    }
+    bool more = (q->count > 0);
+    PyThread_release_lock(q->mutex);
+    if (more)
+        signalEventQueue(q);        // so the next call returns the rest right away
+    Py_XDECREF(names);
+    if (!names)
+        Py_CLEAR(events);
+    return events;
+}
+
+
+// wakeReplicationEventQueue(queue)
+static PyObject* native_wakeReplicationEventQueue(PyObject *self, PyObject *args) {
+    PyObject *capsule;
+    if (!PyArg_ParseTuple(args, "O:wakeReplicationEventQueue", &capsule))
+        return NULL;
+    ReplicationEventQueue *q = PyCapsule_GetPointer(capsule, kReplicationEventQueueName);
+    if (!q)
+        return NULL;
+    signalEventQueue(q);
+    Py_RETURN_NONE;
+}
+
+
+// replicationEventCounts(queue) -> {"scope.name": (pushed, pulled, errors)}, dropped
+static PyObject* native_replicationEventCounts(PyObject *self, PyObject *args) {
+    PyObject *capsule;
+    if (!PyArg_ParseTuple(args, "O:replicationEventCounts", &capsule))
+        return NULL;
+    ReplicationEventQueue *q = PyCapsule_GetPointer(capsule, kReplicationEventQueueName);
+    if (!q)
+        return NULL;
+    PyObject *counts = PyDict_New();
+    PyThread_acquire_lock(q->mutex, WAIT_LOCK);
+    uint64_t dropped = q->dropped;
+    for (size_t i = 0; counts && i < q->collectionCount; i++) {
+        const CollectionCounts *c = &q->collections[i];
+        PyObject *name = collectionFullName(c);
+        PyObject *value = Py_BuildValue("(KKK)", (unsigned long long)c->pushed,
+                                        (unsigned long long)c->pulled, (unsigned long long)c->errors);
+        if (!name || !value || PyDict_SetItem(counts, name, value) < 0)
+            Py_CLEAR(counts);
+        Py_XDECREF(name);
+        Py_XDECREF(value);
+    }
+    PyThread_release_lock(q->mutex);
+    if (!counts)
+        return NULL;
+    return Py_BuildValue("(NK)", counts, (unsigned long long)dropped);
+}
+
+
+//////// CHANGE NOTIFICATIONS
+
+
+// Collects the IDs of changed documents while a database is in buffered-notification mode, so a
+// burst of changes costs one call into Python instead of one per CBL notification. The CBL
+// callbacks below run without the GIL; they only take `mutex`.
+typedef struct {
+    CBLDatabase *db;
+    CBLListenerToken *token;
+    PyThread_type_lock mutex;       // protects the fields below
+    PyThread_type_lock ready;       // held except while notifications are waiting to be sent
+    bool signaled;
+    FLSliceResult *ids;             // distinct changed doc IDs, in order of first change
+    size_t count, capacity;
+    size_t *table;                  // open-addressed hash set; entries are indexes+1 into `ids`
+    size_t tableSize;
+} ChangeBuffer;
+
+static const char *kChangeBufferName = "CBLForPython.ChangeBuffer";
+
+
+static bool growChangeTable(ChangeBuffer *buf) {
+    size_t size = buf->tableSize ? 2 * buf->tableSize : 256;
+    size_t *table = calloc(size, sizeof(size_t));
+    if (!table)
+        return false;
+    for (size_t i = 0; i < buf->count; i++) {
+        size_t slot = FLSlice_Hash((FLSlice){buf->ids[i].buf, buf->ids[i].size}) & (size - 1);
+        while (table[slot])
+            slot = (slot + 1) & (size - 1);
+        table[slot] = i + 1;
+    }
+    free(buf->table);
+    buf->table = table;
+    buf->tableSize = size;
+    return true;
+}
+
+// Adds a doc ID unless it's already present. Must be called with `mutex` held.
+static void addChangedID(ChangeBuffer *buf, FLString docID) {
+    if (4 * (buf->count + 1) > 3 * buf->tableSize && !growChangeTable(buf))
+        return;     // out of memory; there's no way to report it from a CBL callback
+    size_t mask = buf->tableSize - 1, slot = FLSlice_Hash(docID) & mask, index;
+    while ((index = buf->table[slot]) != 0) {
+        FLSliceResult id = buf->ids[index - 1];
+        if (FLSlice_Equal((FLSlice){id.buf, id.size}, docID))
+            return;
+        slot = (slot + 1) & mask;
+    }
+    if (buf->count == buf->capacity) {
+        size_t capacity = buf->capacity ? 2 * buf->capacity : 256;
+        FLSliceResult *ids = realloc(buf->ids, capacity * sizeof(FLSliceResult));
+        if (!ids)
+            return;
+        buf->ids = ids;
+        buf->capacity = capacity;
+    }
+    buf->ids[buf->count++] = FLSlice_Copy(docID);
+    buf->table[slot] = buf->count;
+}
+
+static void clearChangedIDs(ChangeBuffer *buf) {
+    for (size_t i = 0; i < buf->count; i++)
+        FLSliceResult_Release(buf->ids[i]);
+    buf->count = 0;
+    if (buf->table)
+        memset(buf->table, 0, buf->tableSize * sizeof(size_t));
+}
+
+
+// CBLDatabaseChangeListener; called by CBLDatabase_SendNotifications.
+static void changeBufferListener(void *context, const CBLDatabase *db, unsigned numDocs, FLString *docIDs) {
+    ChangeBuffer *buf = context;
+    PyThread_acquire_lock(buf->mutex, WAIT_LOCK);
+    for (unsigned i = 0; i < numDocs; i++)
+        addChangedID(buf, docIDs[i]);
+    PyThread_release_lock(buf->mutex);
+}
+
+// CBLNotificationsReadyCallback; wakes up `waitForChanges`. Called on an arbitrary thread.
+static void changeBufferReady(void *context, CBLDatabase *db) {
+    ChangeBuffer *buf = context;
+    PyThread_acquire_lock(buf->mutex, WAIT_LOCK);
+    if (!buf->signaled) {
+        buf->signaled = true;
+        PyThread_release_lock(buf->ready);
+    }
+    PyThread_release_lock(buf->mutex);
+}
+
+
+static void destroyChangeBuffer(ChangeBuffer *buf) {
+    if (buf->db) {
+        CBLListener_Remove(buf->token);
+        CBLDatabase_BufferNotifications(buf->db, NULL, NULL);
+        // Deliver what was still buffered to the other listeners, instead of dropping it:
+        CBLDatabase_SendNotifications(buf->db);
+        CBL_Release(buf->db);
+    }
+    clearChangedIDs(buf);
+    free(buf->ids);
+    free(buf->table);
+    if (buf->ready) {
+        if (!buf->signaled)
+            PyThread_release_lock(buf->ready);
+        PyThread_free_lock(buf->ready);
+    }
+    if (buf->mutex)
+        PyThread_free_lock(buf->mutex);
+    free(buf);
+}
+
+static void freeChangeBuffer(PyObject *capsule) {
+    destroyChangeBuffer(PyCapsule_GetPointer(capsule, kChangeBufferName));
+}
+
+
+static ChangeBuffer* getChangeBuffer(PyObject *capsule) {
+    return PyCapsule_GetPointer(capsule, kChangeBufferName);
+}
+
+
+// newChangeBuffer(dbAddress) -> ChangeBuffer capsule
+static PyObject* native_newChangeBuffer(PyObject *self, PyObject *args) {
+    PyObject *dbAddr;
+    if (!PyArg_ParseTuple(args, "O:newChangeBuffer", &dbAddr))
+        return NULL;
+    CBLDatabase *db = asPointer(dbAddr);
+    if (!db)
+        return PyErr_Occurred() ? NULL : PyErr_Format(PyExc_ValueError, "NULL database");
+    ChangeBuffer *buf = calloc(1, sizeof(ChangeBuffer));
+    if (!buf)
+        return PyErr_NoMemory();
+    buf->mutex = PyThread_allocate_lock();
+    buf->ready = PyThread_allocate_lock();
+    if (!buf->mutex || !buf->ready || !growChangeTable(buf)) {
+        buf->signaled = true;       // i.e. `ready` isn't held
+        destroyChangeBuffer(buf);
+        return PyErr_NoMemory();
+    }
+    PyThread_acquire_lock(buf->ready, WAIT_LOCK);
+    PyObject *capsule = PyCapsule_New(buf, kChangeBufferName, freeChangeBuffer);
+    if (!capsule) {
+        destroyChangeBuffer(buf);
+        return NULL;
+    }
+    buf->db = (CBLDatabase*)CBL_Retain(db);
+    buf->token = CBLDatabase_AddChangeListener(db, changeBufferListener, buf);
+    CBLDatabase_BufferNotifications(db, changeBufferReady, buf);
+    return capsule;
+}
+
+
+// waitForChanges(buffer, timeout) -> [docID]
+static PyObject* native_waitForChanges(PyObject *self, PyObject *args) {
+    PyObject *capsule;
+    double timeout;
+    if (!PyArg_ParseTuple(args, "Od:waitForChanges", &capsule, &timeout))
+        return NULL;
+    ChangeBuffer *buf = getChangeBuffer(capsule);
+    if (!buf)
+        return NULL;
+    PY_TIMEOUT_T micros = (timeout < 0) ? -1 : (PY_TIMEOUT_T)(timeout * 1e6);
+    Py_BEGIN_ALLOW_THREADS
+    if (PyThread_acquire_lock_timed(buf->ready, micros, 0) == PY_LOCK_ACQUIRED) {
+        PyThread_acquire_lock(buf->mutex, WAIT_LOCK);
+        buf->signaled = false;
+        PyThread_release_lock(buf->mutex);
+        // This calls every listener on the database, including `changeBufferListener`:
+        CBLDatabase_SendNotifications(buf->db);
+    }
+    Py_END_ALLOW_THREADS
+
+    PyThread_acquire_lock(buf->mutex, WAIT_LOCK);
+    PyObject *docIDs = PyList_New((Py_ssize_t)buf->count);
+    for (size_t i = 0; docIDs && i < buf->count; i++) {
+        PyObject *docID = PyUnicode_FromStringAndSize(buf->ids[i].buf, (Py_ssize_t)buf->ids[i].size);
+        if (!docID)
+            Py_CLEAR(docIDs);
+        else
+            PyList_SET_ITEM(docIDs, i, docID);
+    }
+    clearChangedIDs(buf);
+    PyThread_release_lock(buf->mutex);
+    return docIDs;
+}
+
+
+// wakeChangeBuffer(buffer)
+static PyObject* native_wakeChangeBuffer(PyObject *self, PyObject *args) {
+    PyObject *capsule;
+    if (!PyArg_ParseTuple(args, "O:wakeChangeBuffer", &capsule))
+        return NULL;
+    ChangeBuffer *buf = getChangeBuffer(capsule);
+    if (!buf)
+        return NULL;
+    changeBufferReady(buf, buf->db);
+    Py_RETURN_NONE;
+}
+
+
+//////// MODULE
+
+
+static PyMethodDef sNativeMethods[] = {
+    {"decode", native_decode, METH_VARARGS,
+        "decode(address, blobFactory=None, dictType=None)\n"
+        "Converts the Fleece value at `address` to Python objects, recursively. Blob "
+        "dictionaries are passed (by address) to `blobFactory`, if given; other dictionaries "
+        "are created as instances of `dictType`, if given, instead of dict."},
+    {"setDocumentProperties", native_setDocumentProperties, METH_VARARGS,
+        "setDocumentProperties(docAddress, props)\n"
+        "Replaces a mutable CBLDocument's properties with the contents of the dict `props`, "
+        "encoding them directly to Fleece."},
+    {"applyDocumentChanges", native_applyDocumentChanges, METH_VARARGS,
+        "applyDocumentChanges(docAddress, trackedProps)\n"
+        "Updates a mutable CBLDocument's properties with just the changes recorded in "
+        "`trackedProps`, a `_TrackedDict` decoded from them, and marks it clean."},
+    {"encodeDocument", native_encodeDocument, METH_VARARGS,
+        "encodeDocument(value)\n"
+        "Encodes a Python value to Fleece with an FLEncoder. Returns the address of a new FLDoc, "
+        "which the caller must release with `FLDoc_Release`."},
+    {"saveDocuments", native_saveDocuments, METH_VARARGS,
+        "saveDocuments(dbAddress, entries, concurrency, errorsAddress, collectionAddress=None)\n"
+        "Saves a sequence of `(docID, properties, docAddress)` entries, to the CBLCollection at "
+        "`collectionAddress` if given, else the default collection; if `docAddress` is 0 a "
+        "new document is created, and if `properties` is None the document's are left alone. "
+        "Errors are written to the CBLError array at `errorsAddress`, and a list of "
+        "`(index, exception)` is returned for the entries that failed; `exception` is None "
+        "if the failure was a CBL error."},
+    {"getDocuments", native_getDocuments, METH_VARARGS,
+        "getDocuments(dbAddress, ids, decode, blobFactory, errorAddress)\n"
+        "Looks up documents by ID. Returns `(results, failedIndex)`; each result is the decoded "
+        "properties if `decode` is true, else the (retained) CBLDocument's address, or None if "
+        "there's no such document. If a lookup fails, `failedIndex` is its index and the error "
+        "is stored at `errorAddress`; otherwise it's -1."},
+    {"executeColumnar", native_executeColumnar, METH_VARARGS,
+        "executeColumnar(queryAddress, blobFactory, errorAddress)\n"
+        "Runs a CBLQuery and returns its results as a list of columns. Columns whose values are "
+        "all ints, all numbers, or all booleans are `array.array`s of type 'q', 'd' or 'b'; "
+        "others are lists. Returns None if the query fails, with the error stored at "
+        "`errorAddress`."},
+    {"diffResults", native_diffResults, METH_VARARGS,
+        "diffResults(resultSetAddress, keyColumn, previous, blobFactory)\n"
+        "Reads a CBLResultSet and compares its rows, by the value of column `keyColumn`, with "
+        "`previous`. Returns (rows, current, added, changed, removed); unchanged rows are reused "
+        "from `previous` instead of being decoded."},
+    {"importJSONLines",native_importJSONLines, METH_VARARGS,
+        "importJSONLines(dbAddress, lines, idField, concurrency, errorsAddress)\n"
+        "Saves each line (bytes or str) of JSON as a new document, taking its ID from the "
+        "string property `idField` if it's not None; blank lines are skipped. Returns a list "
+        "of `(index, exception)` like `saveDocuments`."},
+    {"exportJSONLines", native_exportJSONLines, METH_VARARGS,
+        "exportJSONLines(queryAddress, documents, idField, write, progress, errorAddress)\n"
+        "Runs a query and passes its results, as lines of JSON, to `write` in chunks of about "
+        "1MB. If `documents` is true the query's columns must be document IDs and properties, "
+        "like `SELECT meta().id, *`, and the lines are the properties, plus the ID as property "
+        "`idField` if it's not None. Otherwise the lines are the rows' result dicts. `progress`, unless None, is "
+        "called with the number of lines written after each chunk. Returns the number of lines, "
+        "or -1 if the query fails, with the error stored at `errorAddress`."},
+    {"evalKeyPath", native_evalKeyPath, METH_VARARGS,
+        "evalKeyPath(address, path, blobFactory, missing)\n"
+        "Evaluates a Fleece key path like \"order.items[3].sku\" on the Fleece value at "
+        "`address`, and decodes only the value it selects; returns `missing` if there's none. "
+        "Compiled key paths are cached."},
+    {"project", native_project, METH_VARARGS,
+        "project(dbAddress, collectionAddress, ids, paths, blobFactory, missing, errorAddress)\n"
+        "Looks up documents by ID, from the CBLCollection at `collectionAddress` if it's not None, "
+        "else from the database, and evaluates each key path in `paths` on each one. Returns "
+        "`(rows, failedIndex)`; each row is a tuple of decoded values (`missing` where a path "
+        "selects nothing), or None if there's no such document. `failedIndex` is as for "
+        "`getDocuments`."},
+    {"newReplicationFilter", native_newReplicationFilter, METH_VARARGS,
+        "newReplicationFilter(rules, passDeletions, callbackAddress, callbackContextAddress)\n"
+        "Compiles a list of `(kind, negate, path, value)` rules into a native replication filter, "
+        "returned as a capsule. A document passes if every rule does (or, if `passDeletions`, "
+        "if it's deleted or its access was removed), and then if the CBLReplicationFilter at "
+        "`callbackAddress`, if any, returns true when called with `callbackContextAddress`."},
+    {"replicationFilterMatches", native_replicationFilterMatches, METH_VARARGS,
+        "replicationFilterMatches(filter, docAddress, flags)\n"
+        "Evaluates a compiled replication filter on the CBLDocument at `docAddress`."},
+    {"newReplicationFilterPair", native_newReplicationFilterPair, METH_VARARGS,
+        "newReplicationFilterPair(push, pull)\n"
+        "Combines compiled push and pull filters (either may be None) for use as a replicator "
+        "configuration's filters. Returns `(capsule, contextAddress, pushAddress, pullAddress)`: "
+        "the capsule keeps them alive, the context goes in the configuration's `context`, and the "
+        "other addresses, which are 0 for a None filter, are its `pushFilter` and `pullFilter`."},
+    {"newReplicationEventQueue", native_newReplicationEventQueue, METH_VARARGS,
+        "newReplicationEventQueue(replicatorAddress, capacity)\n"
+        "Adds a native document-replication listener to a CBLReplicator, which counts the "
+        "documents pushed, pulled and failed per collection, and returns it as a capsule. "
+        "Releasing the capsule removes the listener."},
+    {"keepReplicationEvents", native_keepReplicationEvents, METH_VARARGS,
+        "keepReplicationEvents(queue, keep)\n"
+        "Turns queueing of events on or off; while it's on, up to `capacity` events are kept "
+        "for `waitForReplicationEvents`, and any more are dropped (and counted.)"},
+    {"waitForReplicationEvents", native_waitForReplicationEvents, METH_VARARGS,
+        "waitForReplicationEvents(queue, timeout, maxEvents)\n"
+        "Waits up to `timeout` seconds (forever if negative) for queued events, then dequeues up "
+        "to `maxEvents` of them (all, if it's not positive) and returns them as a list of "
+        "`(docID, isPush, flags, collection, errorDomain, errorCode)`, where `collection` is "
+        "\"scope.name\". The list may be empty."},
+    {"wakeReplicationEventQueue", native_wakeReplicationEventQueue, METH_VARARGS,
+        "wakeReplicationEventQueue(queue)\n"
+        "Makes a pending or the next `waitForReplicationEvents` call return right away."},
+    {"replicationEventCounts", native_replicationEventCounts, METH_VARARGS,
+        "replicationEventCounts(queue)\n"
+        "Returns `(counts, dropped)`: a dict mapping \"scope.name\" to the numbers of documents "
+        "`(pushed, pulled, failed)` in that collection, and the number of events dropped "
+        "because the queue was full."},
+    {"newChangeBuffer", native_newChangeBuffer, METH_VARARGS,
+        "newChangeBuffer(dbAddress)\n"
+        "Puts a database in buffered-notification mode and returns a ChangeBuffer capsule that "
+        "collects the IDs of changed documents natively, without duplicates. Releasing the "
+        "capsule turns buffering off again."},
+    {"waitForChanges", native_waitForChanges, METH_VARARGS,
+        "waitForChanges(buffer, timeout)\n"
+        "Waits up to `timeout` seconds (forever if negative) for notifications to be ready, "
+        "then sends them on this thread, to all of the database's listeners. Returns the list "
+        "of doc IDs collected since the last call, which may be empty."},
+    {"wakeChangeBuffer", native_wakeChangeBuffer, METH_VARARGS,
+        "wakeChangeBuffer(buffer)\n"
+        "Makes a pending or the next `waitForChanges` call return right away."},
+    {"clearKeyCache", native_clearKeyCache, METH_NOARGS,
+        "Empties the cache of interned dictionary keys."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef sNativeModule = {
+    PyModuleDef_HEAD_INIT,
+    "_PyCBLNative",
+    "Native helpers for the Couchbase Lite Python binding.",
+    -1,
+    sNativeMethods
+};
+
+PyMODINIT_FUNC PyInit__PyCBLNative(void) {
+    return PyModule_Create(&sNativeModule);
+}
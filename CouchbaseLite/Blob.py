@@ -18,14 +18,45 @@
 from ._PyCBL import ffi, lib
 from .Collections import *
 from .common import *
+import io
+
+class Blob (CBLObject):
+    _database = None    # set if known, for `Database.stats`
 
-class Blob (object):
     def __init__(self, data, *, contentType =None, fdict =None):
         if fdict != None:
-            super.__init__(lib.FLDict_GetBlob(fdict), "Dict is not a Blob")
+            # The dict's document owns the CBLBlob, so retain it to keep it valid after that's gone
+            CBLObject.__init__(self, ffi.cast("CBLBlob*", lib.CBL_Retain(lib.FLDict_GetBlob(fdict))),
+                               "Dict is not a Blob")
         else:
-            super.__init__(lib.CBLBlob_CreateWithData(contentType, asSlice(data)),
-                           "Failed to create Blob")
+            contents = ffi.from_buffer(data)
+            CBLObject.__init__(self, lib.CBLBlob_CreateWithData(stringParam(contentType), [contents, len(contents)]),
+                               "Failed to create Blob")
+            self._data = data
+
+    @staticmethod
+    def _fromRef(ref):
+        # Wraps a new (already retained) CBLBlob. CBLBlob_CreateWithStream doesn't report an
+        # error, so there's no CBLError to pass along if it failed.
+        blob = Blob.__new__(Blob)
+        CBLObject.__init__(blob, ref, "Failed to create Blob from the data written")
+        return blob
+
+    kFileChunkSize = 1024 * 1024
+
+    @staticmethod
+    def fromFile(database, path, contentType =None):
+        """Creates a blob from the contents of a file, copying it into the database's blob store
+           one chunk at a time so that memory use doesn't depend on the file's size."""
+        chunk = bytearray(Blob.kFileChunkSize)
+        view = memoryview(chunk)
+        with open(path, "rb", buffering=0) as file, BlobWriter(database, contentType) as writer:
+            while True:
+                n = file.readinto(chunk)
+                if not n:
+                    break
+                writer.write(view[:n])
+        return writer.blob
 
     @property
     def digest(self):
@@ -39,28 +70,152 @@ class Blob (object):
     def contentType(self):
         return sliceToString(lib.CBLBlob_ContentType(self._ref))
     
+    @property
+    def _blobAddress(self):
+        # Used by the native Fleece encoder to store this blob in a document
+        return address(self._ref)
+
+    @property
+    def content(self):
+        """The blob's contents, as a read-only memoryview. This avoids copying them, but they're
+           still read into memory all at once; use `openStream` for large blobs."""
+        if "_data" in self.__dict__:
+            return memoryview(self._data).toreadonly()
+        sliceResult = lib.CBLBlob_Content(self._ref, threadError())
+        if not sliceResult.buf:
+            if self.length == 0:
+                return memoryview(b"")
+            raise CBLException("Couldn't read blob", threadError())
+        return sliceResultToMemoryView(sliceResult)
+
     @property
     def data(self):
+        """The blob's contents, as a bytes object."""
         if "_data" in self.__dict__:
             return self._data
-        elif self.digest != None:
-            sliceResult = lib.CBLBlob_Content(self._ref, gError)
-            # OPT: This copies the bytes
-            result = sliceResultToBytes(sliceResult)
-            lib.FLSliceResult_Release(sliceResult)
-            return result
-        else:
-            return None
+        return bytes(self.content)
+
+    def openStream(self):
+        """Returns a BlobReader that reads the contents incrementally."""
+        return BlobReader(self)
 
     def __repr__(self):
         r = "Blob["
         if self.contentType != None:
-            r += self.contentType
-        if self.length != None:
-            if self.contentType != None:
-                r += ", "
-                r += self.length + " bytes"
-        return r + "]"
+            r += self.contentType + ", "
+        return r + str(self.length) + " bytes]"
 
     def _jsonEncodable(self):
         return decodeFleeceDict( lib.CBLBlob_Properties(self._ref), depth=99 )
+
+
+class BlobReader (io.RawIOBase):
+    """A read-only, seekable binary file object for reading a blob's contents, without
+       loading them into memory. Wrap it in an `io.BufferedReader` for efficient small reads."""
+
+    def __init__(self, blob):
+        io.RawIOBase.__init__(self)
+        self._stream = None
+        self._blob = blob           # keeps the CBLBlob alive
+        self._stream = lib.CBLBlob_OpenContentStream(blob._ref, threadError())
+        if not self._stream:
+            raise CBLException("Couldn't open blob", threadError())
+
+    def readable(self):
+        return True
+
+    def seekable(self):
+        return True
+
+    def readinto(self, buffer):
+        self._checkOpen()
+        dst = ffi.from_buffer(buffer, require_writable=True)
+        n = lib.CBLBlobReader_Read(self._stream, dst, len(dst), threadError())
+        if n < 0:
+            raise CBLException("Couldn't read blob", threadError())
+        database = self._blob._database
+        if database is not None and database._stats is not None:
+            database._stats.count("blob.bytesRead", n)
+        return n
+
+    def seek(self, offset, whence =io.SEEK_SET):
+        # CBLSeekBase's values are the same as io.SEEK_SET, SEEK_CUR and SEEK_END
+        self._checkOpen()
+        if whence not in (io.SEEK_SET, io.SEEK_CUR, io.SEEK_END):
+            raise ValueError("invalid whence value")
+        pos = lib.CBLBlobReader_Seek(self._stream, offset, whence, threadError())
+        if pos < 0:
+            raise CBLException("Couldn't seek in blob", threadError())
+        return pos
+
+    def tell(self):
+        self._checkOpen()
+        return lib.CBLBlobReader_Position(self._stream)
+
+    def close(self):
+        if self._stream:
+            lib.CBLBlobReader_Close(self._stream)
+            self._stream = None
+        io.RawIOBase.close(self)
+
+    def _checkOpen(self):
+        if not self._stream:
+            raise ValueError("I/O operation on closed BlobReader")
+
+
+class BlobWriter (io.RawIOBase):
+    """A write-only binary file object that streams a new blob's contents into the database,
+       instead of passing them to the Blob constructor all at once. Use it as a context manager;
+       when the `with` block exits normally the blob is created and stored in `blob`, while if it
+       raises an exception the contents are discarded:
+
+           with BlobWriter(db, "image/jpeg") as writer:
+               writer.write(...)
+           doc["photo"] = writer.blob
+    """
+
+    def __init__(self, database, contentType =None):
+        io.RawIOBase.__init__(self)
+        self.contentType = contentType
+        self.blob = None
+        self._database = database
+        self._stream = lib.CBLBlobWriter_Create(database._ref, threadError())
+        if not self._stream:
+            raise CBLException("Couldn't create blob writer", threadError())
+
+    def writable(self):
+        return True
+
+    def write(self, data):
+        if not self._stream:
+            raise ValueError("I/O operation on closed BlobWriter")
+        src = ffi.from_buffer(data)
+        if not lib.CBLBlobWriter_Write(self._stream, src, len(src), threadError()):
+            raise CBLException("Couldn't write blob", threadError())
+        if self._database._stats is not None:
+            self._database._stats.count("blob.bytesWritten", len(src))
+        return len(src)
+
+    def finish(self):
+        """Creates the Blob from the data written, and returns it. The writer is then closed."""
+        if not self._stream:
+            raise ValueError("I/O operation on closed BlobWriter")
+        stream = self._stream
+        self._stream = None       # CBLBlob_CreateWithStream takes ownership of the stream
+        self.blob = Blob._fromRef(lib.CBLBlob_CreateWithStream(stringParam(self.contentType), stream))
+        self.blob._database = self._database
+        io.RawIOBase.close(self)
+        return self.blob
+
+    def close(self):
+        """Closes the writer, discarding the data unless `finish` was called."""
+        if self._stream:
+            lib.CBLBlobWriter_Close(self._stream)
+            self._stream = None
+        io.RawIOBase.close(self)
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        if exc_type is None and self._stream:
+            self.finish()
+        else:
+            self.close()
@@ -0,0 +1,236 @@
+# Collection.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# (Not to be confused with `Collections.py`, which has the Fleece-backed Array and Dictionary.)
+
+import datetime
+import math
+from time import perf_counter
+
+from ._PyCBL import ffi, lib
+from .common import *
+from .Collections import decodeFleece
+from .Document import *
+
+DefaultScopeName = "_default"
+DefaultCollectionName = "_default"
+
+
+def _releasedNames(mutableArray):
+    # Decodes and releases a FLMutableArray of names returned by CBL
+    if not mutableArray:
+        return []
+    names = decodeFleece(ffi.cast("FLArray", mutableArray))
+    lib.FLValue_Release(ffi.cast("FLValue", mutableArray))
+    return names
+
+
+class Scope:
+    """A named group of collections in a database. Get one from `Database.scope`."""
+
+    def __init__(self, database, name):
+        self.database = database
+        self.name = name
+
+    def __repr__(self):
+        return "Scope['" + self.name + "']"
+
+    @property
+    def collectionNames(self):
+        return self.database.collectionNames(self.name)
+
+    def collection(self, name, create=True):
+        return self.database.collection(name, self.name, create)
+
+
+class Collection (CBLObject):
+    """A named set of documents in a database, with its own indexes. Splitting different kinds
+       of documents into collections lets each query scan a smaller table and smaller indexes.
+       Get one from `Database.collection`.
+
+       Queries name a collection in their FROM clause, e.g. `SELECT * FROM store.orders`;
+       create them with `Database.query` as usual."""
+
+    def __init__(self, database, ref):
+        CBLObject.__init__(self, ref, "Couldn't get collection", threadError())
+        self.database = database
+        self.name = sliceToString(lib.CBLCollection_Name(self._ref))
+        scope = lib.CBLCollection_Scope(self._ref)
+        self.scopeName = sliceToString(lib.CBLScope_Name(scope))
+        lib.CBL_Release(scope)
+
+    def __repr__(self):
+        return "Collection['" + self.fullName + "']"
+
+    @property
+    def fullName(self):
+        return self.scopeName + "." + self.name
+
+    @property
+    def isDefault(self):
+        return self.scopeName == DefaultScopeName and self.name == DefaultCollectionName
+
+    @property
+    def scope(self):
+        return Scope(self.database, self.scopeName)
+
+    @property
+    def count(self):
+        return lib.CBLCollection_Count(self._ref)
+
+    # Documents:
+
+    def getDocument(self, id):
+        return self._get(id, Document, lib.CBLCollection_GetDocument)
+
+    def getMutableDocument(self, id):
+        return self._get(id, MutableDocument, lib.CBLCollection_GetMutableDocument)
+
+    def _get(self, id, docClass, getter):
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        ref = getter(self._ref, stringParam(id), threadError())
+        if stats is not None:
+            stats.since("document.get", start)
+        if not ref:
+            if threadError().code != 0:
+                raise CBLException("Couldn't get document " + id, threadError())
+            return None
+        doc = docClass(id)
+        doc.database = self.database
+        doc.collection = self
+        doc._ref = ref
+        return doc
+
+    def saveDocument(self, doc, concurrency=FailOnConflict):
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+            doc._prepareToSave()
+            stats.since("fleece.encode", start)
+            start = perf_counter()
+        else:
+            doc._prepareToSave()
+        saved = lib.CBLCollection_SaveDocumentWithConcurrencyControl(
+            self._ref, doc._ref, concurrency, threadError()
+        )
+        if stats is not None:
+            stats.since("document.save", start)
+        if not saved:
+            raise CBLException("Couldn't save document", threadError())
+        self.database._writeCount += 1
+        self.database._invalidateCached((doc.id,), self)
+
+    def saveDocuments(self, docs, chunkSize=1000, concurrency=FailOnConflict):
+        """Saves many documents to this collection, like `Database.saveDocuments`."""
+        return self.database._saveDocuments(docs, chunkSize, concurrency, self)
+
+    def project(self, ids, paths, default=None):
+        """Evaluates key paths on many documents in this collection, like `Database.project`."""
+        return self.database._project(ids, paths, default, self._ref)
+
+    def deleteDocument(self, id, concurrency=LastWriteWins):
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        doc = lib.CBLCollection_GetDocument(self._ref, stringParam(id), threadError())
+        if not doc and threadError().code == 0:
+            raise CBLException("Couldn't delete document " + id, notFoundError())
+        deleted = bool(doc) and lib.CBLCollection_DeleteDocumentWithConcurrencyControl(
+            self._ref, doc, concurrency, threadError()
+        )
+        if doc:
+            lib.CBL_Release(doc)
+        if stats is not None:
+            stats.since("document.delete", start)
+        if not deleted:
+            raise CBLException("Couldn't delete document", threadError())
+        self.database._deleteCount += 1
+        self.database._invalidateCached((id,), self)
+
+    def purgeDocument(self, id):
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        purged = lib.CBLCollection_PurgeDocumentByID(self._ref, stringParam(id), threadError())
+        if stats is not None:
+            stats.since("document.purge", start)
+        if not purged:
+            raise CBLException("Couldn't purge document", threadError())
+        self.database._deleteCount += 1
+        self.database._invalidateCached((id,), self)
+
+    def __getitem__(self, id):
+        return self.getMutableDocument(id)
+
+    def __setitem__(self, id, doc):
+        if id != doc.id:
+            raise CBLException("key does not match document ID")
+        self.saveDocument(doc)
+
+    def __delitem__(self, id):
+        self.deleteDocument(id)
+
+    # Expiration:  (CBLTimestamp is in milliseconds)
+
+    def getDocumentExpiration(self, id):
+        exp = lib.CBLCollection_GetDocumentExpiration(self._ref, stringParam(id), threadError())
+        if exp > 0:
+            return datetime.datetime.fromtimestamp(exp / 1000.0)
+        elif exp == 0:
+            return None
+        else:
+            raise CBLException("Couldn't get document's expiration", threadError())
+
+    def setDocumentExpiration(self, id, expDateTime):
+        timestamp = 0
+        if expDateTime != None:
+            timestamp = math.ceil(expDateTime.timestamp() * 1000)
+        if not lib.CBLCollection_SetDocumentExpiration(
+            self._ref, stringParam(id), timestamp, threadError()
+        ):
+            raise CBLException("Couldn't set document's expiration", threadError())
+
+    # Indexes:
+
+    def createIndex(self, name, config):
+        """Creates a value index on this collection, from an IndexConfiguration."""
+        self.database._queries.clear()     # cached queries were compiled without this index
+        if not lib.CBLCollection_CreateValueIndex(
+            self._ref, stringParam(name), config.get_ffi_struct(), threadError()
+        ):
+            raise CBLException("Couldn't create index " + name, threadError())
+
+    def createFullTextIndex(self, name, config):
+        """Creates a full-text index on this collection, from a FullTextIndexConfiguration."""
+        self.database._queries.clear()
+        if not lib.CBLCollection_CreateFullTextIndex(
+            self._ref, stringParam(name), config.get_ffi_struct(), threadError()
+        ):
+            raise CBLException("Couldn't create full-text index " + name, threadError())
+
+    def deleteIndex(self, name):
+        self.database._queries.clear()
+        if not lib.CBLCollection_DeleteIndex(self._ref, stringParam(name), threadError()):
+            raise CBLException("Couldn't delete index " + name, threadError())
+
+    def getIndexNames(self):
+        names = lib.CBLCollection_GetIndexNames(self._ref, threadError())
+        if not names:
+            raise CBLException("Couldn't get index names", threadError())
+        return _releasedNames(names)
@@ -16,11 +16,15 @@
 #
 
 from ._PyCBL import ffi, lib
+from . import _PyCBLNative as native
 from .common import *
 from .Blob import Blob
 from collections.abc import Sequence, Mapping
 from functools import total_ordering
+from time import perf_counter
 import json
+import re
+import threading
 
 
 FLArrayType = ffi.typeof("struct $$FLArray *")
@@ -30,8 +34,43 @@ FLDictType  = ffi.typeof("struct $$FLDict *")
 #### FLEECE DECODING:
 
 
+# Full-depth decodes are done in one call by the native decoder in `_PyCBLNative`, instead of
+# walking the value here with several FFI calls per item. (Since a full decode produces only
+# plain dicts and lists, `mutable` makes no difference to it.)
+# Set `useNativeDecoder` to False to force the pure-Python decoder, e.g. for benchmarking.
+useNativeDecoder = True
+kFullDepth = 99
+
+def _blobFromFleece(addr):
+    return Blob(None, fdict=ffi.cast(FLDictType, addr))
+
+def _decodeNative(f):
+    return native.decode(address(f), _blobFromFleece)
+
+
+def fleeceSize(f):
+    """The size in bytes of the encoded Fleece data whose root is `f`, or 0 if `f` isn't the
+       root of its data (e.g. it's nested in something else, or it's a mutable value.)"""
+    value = ffi.cast("FLValue", f)
+    doc = lib.FLValue_FindDoc(value)
+    if not doc:
+        return 0
+    size = lib.FLDoc_GetData(doc).size if lib.FLDoc_GetRoot(doc) == value else 0
+    lib.FLDoc_Release(doc)
+    return size
+
+
 # Most general function, accepts params of type FLValue, FLDict or FLArray.
-def decodeFleece(f, *, depth =99, mutable =False):
+# If `stats` is given, the time taken and the bytes decoded are recorded in it.
+def decodeFleece(f, *, depth =99, mutable =False, stats =None):
+    if stats is not None:
+        start = perf_counter()
+        result = decodeFleece(f, depth=depth, mutable=mutable)
+        stats.since("fleece.decode", start)
+        stats.count("fleece.decode.bytes", fleeceSize(f))
+        return result
+    if useNativeDecoder and depth >= kFullDepth:
+        return _decodeNative(f)
     ffitype = ffi.typeof(f)
     if ffitype == FLDictType:
         return decodeFleeceDict(f, depth=depth, mutable=mutable)
@@ -42,6 +81,8 @@ def decodeFleece(f, *, depth =99, mutable =False):
 
 # Decodes an FLValue (which may of course turn out to be an FLArray or FLDict)
 def decodeFleeceValue(f, *, depth =99, mutable =False):
+    if useNativeDecoder and depth >= kFullDepth:
+        return _decodeNative(f)
     typ = lib.FLValue_GetType(f)
     if typ == lib.kFLString:
         return sliceToString(lib.FLValue_AsString(f))
@@ -66,6 +107,8 @@ def decodeFleeceValue(f, *, depth =99, mutable =False):
 
 # Decodes an FLArray
 def decodeFleeceArray(farray, *, depth =99, mutable =False):
+    if useNativeDecoder and depth >= kFullDepth:
+        return _decodeNative(farray)
     if depth <= 0:
         if mutable:
             return MutableArray(fleece=farray)
@@ -80,6 +123,8 @@ def decodeFleeceArray(farray, *, depth =99, mutable =False):
 
 # Decodes an FLDict
 def decodeFleeceDict(fdict, *, depth =99, mutable =False):
+    if useNativeDecoder and depth >= kFullDepth:
+        return _decodeNative(fdict)
     if lib.FLDict_IsBlob(fdict):
         return Blob(None, fdict=fdict)
     elif depth <= 0:
@@ -101,17 +146,68 @@ def decodeFleeceDict(fdict, *, depth =99, mutable =False):
         return result
 
 
+### Lazy decoding
+
+
+class _DictKeys (object):
+    """A cache of FLDictKeys, which look up the same key in many Fleece dicts faster than a plain
+       string can. An FLDictKey remembers how the key is encoded in one database's shared keys,
+       so each Database has its own cache. Looking a key up writes to it, so each thread has
+       its own cache too."""
+
+    kMaxKeys = 1000
+
+    def __init__(self):
+        self._local = threading.local()
+
+    def get(self, key):
+        """Returns an `FLDictKey*` for the string `key`."""
+        keys = getattr(self._local, "keys", None)
+        if keys is None:
+            keys = self._local.keys = {}
+        entry = keys.get(key)
+        if entry is None:
+            if len(keys) >= self.kMaxKeys:
+                keys.clear()
+            keySlice = stringParam(key)     # FLDictKey points into this, so keep it alive
+            entry = (ffi.new("FLDictKey*", lib.FLDictKey_Init(keySlice)), keySlice)
+            keys[key] = entry
+        return entry[0]
+
+_defaultDictKeys = _DictKeys()
+
+
+def _decodeLazy(value, owner, keys):
+    """Decodes a Fleece value, except that a dict or array becomes a lazy Dictionary or Array
+       that holds a reference to `owner`, which keeps the Fleece data alive."""
+    typ = lib.FLValue_GetType(value)
+    if typ == lib.kFLDict:
+        fdict = ffi.cast(FLDictType, value)
+        if lib.FLDict_IsBlob(fdict):
+            return _blobFromFleece(address(fdict))
+        return Dictionary(fleece=fdict, owner=owner, keys=keys)
+    elif typ == lib.kFLArray:
+        return Array(fleece=ffi.cast(FLArrayType, value), owner=owner, keys=keys)
+    else:
+        return native.decode(address(value))
+
+
 ### Array class
 
 
 @total_ordering
 class Array (Sequence):
-    "A Couchbase Lite array, decoded from a Document or Query. Behaves like a regular Python sequence."
+    """A Couchbase Lite array, decoded from a Document or Query. Behaves like a regular Python sequence.
+       When created from Fleece, items are only decoded when accessed, and nested collections
+       are lazy too."""
 
-    def __init__(self, *, fleece=None):
-        "Constructor: takes an FLArray"
+    def __init__(self, *, fleece=None, owner=None, keys=None):
+        "Constructor: takes an FLArray, and the object that keeps its Fleece data alive."
         if fleece != None:
             self._flArray = fleece
+            self._owner = owner
+            self._keys = keys if keys is not None else _defaultDictKeys
+            self._values = {}
         else:
             self._pyList = []
 
@@ -119,28 +215,41 @@ class Array (Sequence):
         if not "_pyList" in self.__dict__:
             return lib.FLArray_Count(self._flArray)
         return len(self._pyList)
-    
+
     @property
     def _toList(self):
         if not "_pyList" in self.__dict__:
             # Convert Fleece array to Python list:
-            self._pyList = decodeFleeceArray(self._flArray, depth=1)
+            self._pyList = decodeFleeceArray(self._flArray)
             del self._flArray
-            print ("Converted Array to list")
         return self._pyList
-   
+
     def __getitem__(self, i):
-        return self._toList[i]
-    
+        if "_pyList" in self.__dict__:
+            return self._pyList[i]
+        if isinstance(i, slice):
+            return [self[j] for j in range(*i.indices(len(self)))]
+        n = lib.FLArray_Count(self._flArray)
+        if i < 0:
+            i += n
+        if i < 0 or i >= n:
+            raise IndexError("array index out of range")
+        try:
+            return self._values[i]
+        except KeyError:
+            value = _decodeLazy(lib.FLArray_Get(self._flArray, i), self, self._keys)
+            self._values[i] = value
+            return value
+
     def __repr__(self):
         if not "_pyList" in self.__dict__:
             # Don't convert in place; just return the converted form's representation
-            return decodeFleeceArray(self._flArray, depth=999).__repr__()
+            return decodeFleeceArray(self._flArray).__repr__()
         return self._pyList.__repr__()
 
     def __eq__(self, other):
         return self._toList == other
-        
+
     def __gt__(self, other):
         return self._toList > other
 
@@ -153,7 +262,7 @@ class MutableArray (Array):
         self._toList.__setitem__(i, value)
 
     def __delitem__(self, i):
-        self._toList.__deltem__(i)
+        self._toList.__delitem__(i)
 
     def insert(self, i, value):
         self._toList.insert(i, value)
@@ -163,36 +272,70 @@ class MutableArray (Array):
 
 
 class Dictionary (Mapping):
-    "A Couchbase Lite dictionary, decoded from a Document or Query. Behaves like a regular Python mapping."
-    def __init__(self, *, fleece=None):
+    """A Couchbase Lite dictionary, decoded from a Document or Query. Behaves like a regular Python mapping.
+       When created from Fleece, values are looked up and decoded only when accessed, and nested
+       collections are lazy too."""
+
+    def __init__(self, *, fleece=None, owner=None, keys=None):
+        "Constructor: takes an FLDict, and the object that keeps its Fleece data alive."
         if fleece != None:
             self._flDict = fleece
+            self._owner = owner
+            self._keys = keys if keys is not None else _defaultDictKeys
+            self._values = {}
         else:
             self._pyDict = {}
 
     def __len__(self):
-        if not "_pyMap" in self.__dict__:
+        if not "_pyDict" in self.__dict__:
             return lib.FLDict_Count(self._flDict)
-        return len(self._pyMap)
+        return len(self._pyDict)
 
     @property
     def _toDict(self):
-        if not "_pyMap" in self.__dict__:
+        if not "_pyDict" in self.__dict__:
             # Convert Fleece dict to Python mapping:
-            self._pyMap = decodeFleeceDict(self._flDict)
+            self._pyDict = decodeFleeceDict(self._flDict)
             del self._flDict
-        return self._pyMap
+        return self._pyDict
 
     def __getitem__(self, key):
-        return self._toDict.__getitem__(key)
+        if "_pyDict" in self.__dict__:
+            return self._pyDict[key]
+        try:
+            return self._values[key]
+        except KeyError:
+            pass
+        if not isinstance(key, str):
+            raise KeyError(key)
+        value = lib.FLDict_GetWithKey(self._flDict, self._keys.get(key))
+        if not value:
+            raise KeyError(key)
+        value = _decodeLazy(value, self, self._keys)
+        self._values[key] = value
+        return value
+
+    def __contains__(self, key):
+        if "_pyDict" in self.__dict__:
+            return key in self._pyDict
+        return isinstance(key, str) and lib.FLDict_GetWithKey(self._flDict, self._keys.get(key)) != ffi.NULL
 
     def __iter__(self):
-        return self._toDict.__iter__()
-    
+        if "_pyDict" in self.__dict__:
+            return self._pyDict.__iter__()
+        return self._iterFleeceKeys()
+
+    def _iterFleeceKeys(self):
+        i = ffi.new("FLDictIterator*")
+        lib.FLDictIterator_Begin(self._flDict, i)
+        while lib.FLDictIterator_GetValue(i):
+            yield sliceToString(lib.FLDictIterator_GetKeyString(i))
+            lib.FLDictIterator_Next(i)
+
     def __repr__(self):
-        if not "_pyMap" in self.__dict__:
+        if not "_pyDict" in self.__dict__:
             # Don't convert in place; just return the converted form's representation
-            return decodeFleeceDict(self._flDict, depth=999).__repr__()
+            return decodeFleeceDict(self._flDict).__repr__()
         return self._toDict.__repr__()
 
     def __eq__(self, other):
@@ -209,7 +352,137 @@ class MutableDictionary (Dictionary):
         self._toDict.__setitem__(key, value)
 
     def __delitem__(self, key):
-        self._toDict.__deltem__(key)
+        self._toDict.__delitem__(key)
+
+
+### Change tracking
+
+
+class _TrackedDict (dict):
+    """A dict decoded from a MutableDocument's properties, which records what's changed since
+       so that saving can update just those parts of the document (see `applyDocumentChanges`.)
+       `_dirty` holds the keys that have been set or removed. `_touched` holds the keys of
+       nested dicts (also _TrackedDicts) that have been accessed, which may have changes of
+       their own. A list can't track changes, so accessing one marks its key as dirty."""
+
+    __slots__ = ("_dirty", "_touched")
+
+    def __init__(self, *args, **kwargs):
+        dict.__init__(self, *args, **kwargs)
+        self._dirty = set()
+        self._touched = set()
+
+    def _touch(self, key, value):
+        if type(value) is _TrackedDict:
+            self._touched.add(key)
+        elif isinstance(value, list):
+            self._dirty.add(key)
+
+    def _touchAll(self):
+        for key, value in dict.items(self):
+            self._touch(key, value)
+
+    def __getitem__(self, key):
+        value = dict.__getitem__(self, key)
+        self._touch(key, value)
+        return value
+
+    def get(self, key, default =None):
+        if key in self:
+            return self[key]
+        return default
+
+    def setdefault(self, key, default =None):
+        if key not in self:
+            self[key] = default
+        return self[key]
+
+    def values(self):
+        self._touchAll()
+        return dict.values(self)
+
+    def items(self):
+        self._touchAll()
+        return dict.items(self)
+
+    def copy(self):
+        self._touchAll()
+        return dict.copy(self)
+
+    def __setitem__(self, key, value):
+        dict.__setitem__(self, key, value)
+        self._dirty.add(key)
+
+    def __delitem__(self, key):
+        dict.__delitem__(self, key)
+        self._dirty.add(key)
+
+    def pop(self, key, *default):
+        if key in self:
+            self._dirty.add(key)
+        return dict.pop(self, key, *default)
+
+    def popitem(self):
+        key, value = dict.popitem(self)
+        self._dirty.add(key)
+        return key, value
+
+    def clear(self):
+        self._dirty.update(dict.keys(self))
+        dict.clear(self)
+
+    def update(self, *args, **kwargs):
+        for key, value in dict(*args, **kwargs).items():
+            self[key] = value
+
+    def __ior__(self, other):
+        self.update(other)
+        return self
+
+
+def _decodeTracked(fdict):
+    return native.decode(address(fdict), _blobFromFleece, _TrackedDict)
+
+
+### Key paths
+
+
+def evalKeyPath(f, path, default =None):
+    """Evaluates a key path like "order.items[3].sku" on a Fleece value, decoding only the
+       value it selects, or returns `default` if it selects nothing."""
+    return native.evalKeyPath(address(f), path, _blobFromFleece, default)
+
+_kKeyPathComponent = re.compile(r"\[(-?\d+)\]|([^.\[]+)")
+
+def evalKeyPathInPython(value, path, default =None):
+    """Evaluates a key path on already-decoded Python values, the same way as `evalKeyPath`."""
+    if path.startswith("$"):
+        path = path[1:]
+    for index, key in _kKeyPathComponent.findall(path):
+        try:
+            if key:
+                value = value[key] if isinstance(value, Mapping) else default
+            else:
+                value = value[int(index)] if isinstance(value, Sequence) and not isinstance(value, str) else default
+        except (KeyError, IndexError):
+            return default
+        if value is default:
+            return default
+    return value
+
+
+### Fleece Encoder
+
+
+def encodeFleeceProperties(docRef, props):
+    """Replaces a mutable CBLDocument's properties with the dict `props`, encoding it directly
+       to Fleece (via `FLSlot_Set*`) rather than going through JSON."""
+    native.setDocumentProperties(address(docRef), props)
+
+def encodeFleeceChanges(docRef, props):
+    """Updates a mutable CBLDocument's properties with the changes recorded in `props`, a
+       _TrackedDict that was decoded from them."""
+    native.applyDocumentChanges(address(docRef), props)
 
 
 ### JSON Encoder
@@ -16,13 +16,29 @@
 #
 
 import datetime
+import itertools
 import math
+import os
+import queue
+import threading
+import time
+from time import perf_counter
+import traceback
+from contextlib import contextmanager
 from typing import Union, List
 
 from ._PyCBL import ffi, lib
+from . import _PyCBLNative as native
 from .common import *
 from .Document import *
-from .Query import JSONLanguage
+from .Collections import _blobFromFleece, _DictKeys
+from .Query import Query, JSONLanguage, N1QLLanguage, _QueryCache
+from .Stats import Stats
+from .Collection import Collection, Scope, DefaultScopeName, _releasedNames
+from .Maintenance import MaintenanceNames
+from .DocumentCache import DocumentCache
+from .WriteBehind import WriteBehindQueue
+from collections import OrderedDict
 
 
 class IndexConfiguration:
@@ -116,6 +132,14 @@ class DatabaseConfiguration:
 
 
 class Database(CBLObject):
+    # If true, a (non-mutable) Document's `properties` is a read-only Dictionary that decodes
+    # values from Fleece only as they're accessed, instead of a dict decoded all at once. This
+    # is much faster when only a few properties of a large document are read.
+    lazyProperties = False
+
+    # An IndexAdvisor that sees each query compiled by `query()`, if not None.
+    indexAdvisor = None
+
     def __init__(self, name, config=None):
         if config is not None:
             dirSlice = stringParam(config.directory)
@@ -124,23 +148,43 @@ class Database(CBLObject):
             cblConfig = ffi.NULL
         self.name = name
         self.listeners = set()
+        self._queries = _QueryCache()
+        self._dictKeys = _DictKeys()
+        self._changeBuffer = None
+        self._stats = None
+        # Approximate counts of documents saved and deleted/purged through this object, and the
+        # number of open transactions; MaintenanceScheduler reads them to find idle periods.
+        self._writeCount = 0
+        self._deleteCount = 0
+        self._transactions = 0
+        self._maintenance = None
+        self.documentCache = None
+        self.writeBehindQueue = None
         CBLObject.__init__(
             self,
-            lib.CBLDatabase_Open(stringParam(name), cblConfig, gError),
+            lib.CBLDatabase_Open(stringParam(name), cblConfig, threadError()),
             "Couldn't open database " + name,
-            gError,
+            threadError(),
         )
 
     def __repr__(self):
         return "Database['" + self.name + "']"
 
     def close(self):
-        if not lib.CBLDatabase_Close(self._ref, gError):
+        self._queries.clear()
+        self.disableWriteBehind()
+        self.disableDocumentCache()
+        if self._maintenance is not None:
+            self._maintenance.stop()
+        if self._changeBuffer is not None:
+            self._changeBuffer.close()
+            self._changeBuffer = None
+        if not lib.CBLDatabase_Close(self._ref, threadError()):
             print("WARNING: Database.close() failed")
 
     def delete(self):
-        if not lib.CBLDatabase_Delete(self._ref, gError):
-            raise CBLException("Couldn't delete database", gError)
+        if not lib.CBLDatabase_Delete(self._ref, threadError()):
+            raise CBLException("Couldn't delete database", threadError())
 
     def copy(self, to_path, to_name):
         from_path = self.getPath()
@@ -149,24 +193,43 @@ class Database(CBLObject):
             stringParam(from_path),
             stringParam(to_name),
             DatabaseConfiguration(to_path)._cblConfig(),
-            gError,
+            threadError(),
         ):
-            raise CBLException("Couldn't copy database", gError)
+            raise CBLException("Couldn't copy database", threadError())
 
     @staticmethod
     def deleteFile(name, dir):
-        if lib.CBL_DeleteDatabase(stringParam(name), stringParam(dir), gError):
+        if lib.CBL_DeleteDatabase(stringParam(name), stringParam(dir), threadError()):
             return True
-        elif gError.code == 0:
+        elif threadError().code == 0:
             return False
         else:
-            raise CBLException("Couldn't delete database file", gError)
+            raise CBLException("Couldn't delete database file", threadError())
 
     def compact(self):
-        if not lib.CBLDatabase_PerformMaintenance(
-            self._ref, lib.kCBLMaintenanceTypeCompact, gError
-        ):
-            raise CBLException("Couldn't compact database", gError)
+        self.performMaintenance(lib.kCBLMaintenanceTypeCompact)
+
+    def performMaintenance(self, type):
+        """Runs one of the `Maintenance` types (compact, reindex, integrity check, optimize, full
+           optimize.) This can take a while on a big database, and blocks other calls meanwhile;
+           see `Maintenance.MaintenanceScheduler` for running it when the database is idle."""
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        done = lib.CBLDatabase_PerformMaintenance(self._ref, type, threadError())
+        if stats is not None:
+            stats.since("maintenance." + MaintenanceNames[type], start)
+        if not done:
+            raise CBLException("Couldn't perform maintenance on database", threadError())
+
+    @property
+    def fileSize(self):
+        """The total size in bytes of the database's files (the `.cblite2` directory.)"""
+        size = 0
+        for entry in os.scandir(self.path):
+            if entry.is_file():
+                size += entry.stat().st_size
+        return size
 
     def createIndex(self, name, config: IndexConfiguration):
         """
@@ -174,10 +237,11 @@ class Database(CBLObject):
 
         Indexes are persistent. If an identical index with that name already exists, nothing happens (and no error is returned.) If a non-identical index with that name already exists, it is deleted and re-created.
         """
+        self._queries.clear()     # cached queries were compiled without this index
         if not lib.CBLDatabase_CreateValueIndex(
-            self._ref, stringParam(name), config.get_ffi_struct(), gError
+            self._ref, stringParam(name), config.get_ffi_struct(), threadError()
         ):
-            raise CBLException("Couldn't create index " + name, gError)
+            raise CBLException("Couldn't create index " + name, threadError())
 
     def createFullTextIndex(self, name, config: FullTextIndexConfiguration):
         """
@@ -185,17 +249,19 @@ class Database(CBLObject):
 
         Indexes are persistent. If an identical index with that name already exists, nothing happens (and no error is returned.) If a non-identical index with that name already exists, it is deleted and re-created.
         """
+        self._queries.clear()     # cached queries were compiled without this index
         if not lib.CBLDatabase_CreateFullTextIndex(
-            self._ref, stringParam(name), config.get_ffi_struct(), gError
+            self._ref, stringParam(name), config.get_ffi_struct(), threadError()
         ):
-            raise CBLException("Couldn't create full-text index " + name, gError)
+            raise CBLException("Couldn't create full-text index " + name, threadError())
 
     def getIndexNames(self) -> List[str]:
         return decodeFleeceArray(lib.CBLDatabase_GetIndexNames(self._ref))
 
     def deleteIndex(self, name):
-        if not lib.CBLDatabase_DeleteIndex(self._ref, stringParam(name), gError):
-            raise CBLException("Couldn't create index " + name, gError)
+        self._queries.clear()
+        if not lib.CBLDatabase_DeleteIndex(self._ref, stringParam(name), threadError()):
+            raise CBLException("Couldn't create index " + name, threadError())
 
     # Attributes:
 
@@ -214,28 +280,357 @@ class Database(CBLObject):
     def count(self):
         return lib.CBLDatabase_Count(self._ref)
 
+    # Scopes and collections:
+
+    def scopeNames(self):
+        names = lib.CBLDatabase_ScopeNames(self._ref, threadError())
+        if not names:
+            raise CBLException("Couldn't get scope names", threadError())
+        return _releasedNames(names)
+
+    def collectionNames(self, scope=DefaultScopeName):
+        names = lib.CBLDatabase_CollectionNames(self._ref, stringParam(scope), threadError())
+        if not names:
+            raise CBLException("Couldn't get collection names", threadError())
+        return _releasedNames(names)
+
+    def scope(self, name=DefaultScopeName):
+        return Scope(self, name)
+
+    def collection(self, name, scope=DefaultScopeName, create=True):
+        """Returns the Collection with this name in `scope`. If it doesn't exist, it's created
+           if `create` is true, else None is returned."""
+        if create:
+            ref = lib.CBLDatabase_CreateCollection(self._ref, stringParam(name), stringParam(scope), threadError())
+        else:
+            ref = lib.CBLDatabase_Collection(self._ref, stringParam(name), stringParam(scope), threadError())
+            if not ref and threadError().code == 0:
+                return None
+        return Collection(self, ref)
+
+    def defaultCollection(self):
+        return Collection(self, lib.CBLDatabase_DefaultCollection(self._ref, threadError()))
+
+    def deleteCollection(self, name, scope=DefaultScopeName):
+        self._queries.clear()
+        if not lib.CBLDatabase_DeleteCollection(self._ref, stringParam(name), stringParam(scope), threadError()):
+            raise CBLException("Couldn't delete collection " + name, threadError())
+
+    # Statistics:
+
+    def enableStats(self, enabled=True):
+        """Turns on (or off) collecting operation counts and latencies for `stats()`. While
+           they're off, the instrumented calls only pay for checking whether they're on."""
+        if not enabled:
+            self._stats = None
+        elif self._stats is None:
+            self._stats = Stats()
+
+    def stats(self, reset=False):
+        """Returns a snapshot of the counters and latency histograms collected since stats were
+           enabled or last reset, as a dict with "counters" and "latency" items; or None if
+           they're not enabled. If `reset` is true, starts collecting over again."""
+        stats = self._stats
+        if stats is None:
+            return None
+        snapshot = stats.snapshot()
+        if reset:
+            stats.reset()
+        return snapshot
+
+    def resetStats(self):
+        if self._stats is not None:
+            self._stats.reset()
+
+    def _countingListener(self, listener):
+        # Wraps a listener so that its calls are counted while stats are enabled
+        def counted(*args):
+            stats = self._stats
+            if stats is not None:
+                stats.count("listener.callbacks")
+            listener(*args)
+        return counted
+
     # Documents:
 
     def getDocument(self, id):
+        cache = self.documentCache
+        if cache is not None:
+            return cache.get(id)
         return Document._get(self, id)
 
+    def enableDocumentCache(self, maxDocuments=1000, validate=False):
+        """Caches up to `maxDocuments` of the documents most recently read by `getDocument`,
+           with their properties decoded and frozen, and returns the cache. If `validate` is
+           true, each hit is checked against the document's current sequence (see DocumentCache.)"""
+        if self.documentCache is None:
+            self.documentCache = DocumentCache(self, maxDocuments, validate)
+        else:
+            self.documentCache.maxDocuments = maxDocuments
+            self.documentCache.validate = validate
+        return self.documentCache
+
+    def disableDocumentCache(self):
+        if self.documentCache is not None:
+            self.documentCache.close()
+            self.documentCache = None
+
+    def enableWriteBehind(self, maxBatch=1000, maxLatency=0.05, maxPending=100000, merge=None,
+                          concurrency=LastWriteWins):
+        """Starts a WriteBehindQueue, which saves documents in group commits on a background
+           thread, coalescing changes to the same document, and returns it. It commits through
+           its own handle on the database file, so its transactions don't mix with writes made
+           through this one."""
+        if self.writeBehindQueue is None:
+            writer = Database(self.name, self.config)
+            self.writeBehindQueue = WriteBehindQueue(self, maxBatch, maxLatency, maxPending, merge,
+                                                     concurrency, writer)
+        return self.writeBehindQueue
+
+    def disableWriteBehind(self):
+        """Commits the WriteBehindQueue's pending changes, if any, and stops it."""
+        if self.writeBehindQueue is not None:
+            self.writeBehindQueue.close()
+            self.writeBehindQueue = None
+
+    def _invalidateCached(self, ids, collection=None):
+        # Drops documents just written through this object from the document cache, without
+        # waiting for the change listener, which buffered-notification mode delays. `collection`
+        # is the Collection written to, or None for the default one.
+        cache = self.documentCache
+        if cache is not None and (collection is None or collection.isDefault):
+            cache.invalidateMany(ids)
+
+    def getDocuments(self, ids, decode=True, snapshot=False):
+        """
+        Looks up many documents by ID, in one native loop.
+
+        Returns a list with an item for each ID: its decoded properties (a dict) if `decode`
+        is true, otherwise a Document; or None if there's no document with that ID.
+
+        If `snapshot` is true, the documents are read inside a transaction, so they all come
+        from the same state of the database. That's the database's exclusive write
+        transaction, though: it blocks writers on other handles (and other DatabasePool
+        readers) meanwhile, and on a shared handle it joins any transaction another thread
+        has open.
+        """
+        error = ffi.new("CBLError*")
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        if snapshot:
+            with self:
+                results, failedIndex = native.getDocuments(address(self._ref), ids, decode,
+                                                           _blobFromFleece, address(error))
+        else:
+            results, failedIndex = native.getDocuments(address(self._ref), ids, decode,
+                                                       _blobFromFleece, address(error))
+        if stats is not None:
+            stats.since("document.getMany", start)
+            stats.count("document.getMany.docs", len(ids))
+        if failedIndex >= 0:
+            raise CBLException("Couldn't get document " + ids[failedIndex], error)
+        if not decode:
+            results = [Document._fromAddress(self, id, addr) if addr else None
+                       for id, addr in zip(ids, results)]
+        return results
+
     def getMutableDocument(self, id):
         return MutableDocument._get(self, id)
 
+    def project(self, ids, paths, default=None):
+        """
+        Evaluates key paths like "order.items[3].sku" on many documents, in one native loop,
+        decoding only the values they select. Compiled key paths are cached, so the same ones
+        are cheap to use again.
+
+        Returns a list with an item for each ID: a tuple with the value of each path (`default`
+        where a path selects nothing), or None if there's no document with that ID.
+        """
+        return self._project(ids, paths, default, None)
+
+    # Also used by Collection.project, with a CBLCollection* to read from.
+    def _project(self, ids, paths, default, collection):
+        error = ffi.new("CBLError*")
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        rows, failedIndex = native.project(address(self._ref),
+                                           address(collection) if collection else None,
+                                           ids, paths, _blobFromFleece, default, address(error))
+        if stats is not None:
+            stats.since("document.project", start)
+            stats.count("document.project.docs", len(ids))
+        if failedIndex >= 0:
+            raise CBLException("Couldn't get document " + ids[failedIndex], error)
+        return rows
+
     def saveDocument(self, doc, concurrency=FailOnConflict):
-        doc._prepareToSave()
-        if not lib.CBLDatabase_SaveDocumentWithConcurrencyControl(
-            self._ref, doc._ref, concurrency, gError
-        ):
-            raise CBLException("Couldn't save document", gError)
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+            doc._prepareToSave()
+            stats.since("fleece.encode", start)
+            start = perf_counter()
+        else:
+            doc._prepareToSave()
+        saved = lib.CBLDatabase_SaveDocumentWithConcurrencyControl(
+            self._ref, doc._ref, concurrency, threadError()
+        )
+        if stats is not None:
+            stats.since("document.save", start)
+        if not saved:
+            raise CBLException("Couldn't save document", threadError())
+        self._writeCount += 1
+        self._invalidateCached((doc.id,))
+
+    def saveDocuments(self, docs, chunkSize=1000, concurrency=FailOnConflict):
+        """
+        Saves many documents, committing a transaction after every `chunkSize` of them.
+
+        `docs` can be any iterable of MutableDocuments and/or `(docID, properties)` pairs. It's
+        consumed one chunk at a time, so it can be a generator over a very large input. Each chunk
+        is saved by a single native call; pairs are the cheapest form, since no document objects
+        have to be created for them on the Python side.
+
+        A document that fails to save doesn't stop the rest of the batch. Returns a list of
+        `(doc, exception)` for the ones that failed, where `doc` is the item from `docs`.
+        """
+        return self._saveDocuments(docs, chunkSize, concurrency, None)
+
+    # Also used by Collection.saveDocuments, with the Collection to save to.
+    def _saveDocuments(self, docs, chunkSize, concurrency, collection):
+        errors = ffi.new("CBLError[]", chunkSize)
+        failures = []
+        chunk = []
+        for doc in docs:
+            chunk.append(doc)
+            if len(chunk) == chunkSize:
+                self._saveChunk(chunk, concurrency, errors, failures, collection)
+                chunk = []
+        if chunk:
+            self._saveChunk(chunk, concurrency, errors, failures, collection)
+        return failures
+
+    def _saveChunk(self, chunk, concurrency, errors, failures, collection):
+        entries = []
+        for doc in chunk:
+            if isinstance(doc, MutableDocument):
+                entries.append(doc._bulkSaveEntry())
+            else:
+                docID, props = doc
+                entries.append((docID, props, 0))
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        with self:
+            chunkFailures = native.saveDocuments(address(self._ref), entries, concurrency, address(errors),
+                                                 address(collection._ref) if collection is not None else None)
+        if stats is not None:
+            stats.since("document.saveMany", start)
+            stats.count("document.saveMany.docs", len(chunk))
+        self._writeCount += len(chunk) - len(chunkFailures)
+        self._invalidateCached((entry[0] for entry in entries), collection)
+        for index, exception in chunkFailures:
+            doc = chunk[index]
+            if exception is None:
+                docID = doc.id if isinstance(doc, MutableDocument) else doc[0]
+                exception = CBLException("Couldn't save document " + str(docID), errors + index)
+            failures.append((doc, exception))
+
+    # Newline-delimited JSON:
+
+    def importNDJSON(self, file, idField=None, chunkSize=1000, concurrency=FailOnConflict, progress=None):
+        """
+        Saves each line of newline-delimited JSON as a document, committing a transaction after
+        every `chunkSize` lines. The lines are parsed straight into Fleece, without creating
+        Python objects, and only one chunk of them is in memory at a time.
+
+        `file` is a path or a file object (binary or text.) If `idField` is given, a line's
+        document ID is the value of that property, else it's a random UUID. Blank lines are
+        skipped. `progress`, unless None, is called with the number of lines read after each
+        chunk.
+
+        A line that fails to save doesn't stop the import. Returns a list of
+        `(lineNumber, exception)` for the ones that failed, with line numbers starting at 1.
+        """
+        if isinstance(file, (str, bytes, os.PathLike)):
+            with open(file, "rb") as f:
+                return self.importNDJSON(f, idField, chunkSize, concurrency, progress)
+        errors = ffi.new("CBLError[]", chunkSize)
+        failures = []
+        lineCount = 0
+        while True:
+            lines = list(itertools.islice(file, chunkSize))
+            if not lines:
+                break
+            with self:
+                chunkFailures = native.importJSONLines(address(self._ref), lines, idField,
+                                                       concurrency, address(errors))
+            self._writeCount += len(lines) - len(chunkFailures)
+            if self.documentCache is not None:
+                self.documentCache.clear()     # the IDs are only known natively
+            for index, exception in chunkFailures:
+                if exception is None:
+                    exception = CBLException("Couldn't save document", errors + index)
+                failures.append((lineCount + index + 1, exception))
+            lineCount += len(lines)
+            if progress:
+                progress(lineCount)
+        return failures
+
+    def exportNDJSON(self, file, query=None, idField="_id", progress=None):
+        """
+        Writes newline-delimited JSON to `file`, a path or a binary file object. The JSON is
+        generated natively from the Fleece data and written in chunks of about 1MB, without
+        creating Python objects.
+
+        By default every document is written, with its ID added as the property `idField`
+        (unless that's None.) If `query` is given (a Query, or a N1QL string), each of its
+        result rows is written instead, as a dict keyed by column name. `progress`, unless
+        None, is called with the number of lines written so far after each chunk.
+
+        Returns the number of lines written.
+        """
+        if isinstance(file, (str, bytes, os.PathLike)):
+            with open(file, "wb") as f:
+                return self.exportNDJSON(f, query, idField, progress)
+        documents = query is None
+        if documents:
+            query = self.query("SELECT meta().id, * FROM _")
+        else:
+            if isinstance(query, str):
+                query = self.query(query)
+            idField = None
+        count = native.exportJSONLines(address(query._ref), documents, idField, file.write,
+                                       progress, address(threadError()))
+        if count < 0:
+            raise CBLException("Couldn't export documents", threadError())
+        return count
 
     def deleteDocument(self, id):
-        if not lib.CBLDatabase_DeleteDocument(self._ref, stringParam(id), gError):
-            raise CBLException("Couldn't delete document", gError)
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        deleted = lib.CBLDatabase_DeleteDocument(self._ref, stringParam(id), threadError())
+        if stats is not None:
+            stats.since("document.delete", start)
+        if not deleted:
+            raise CBLException("Couldn't delete document", threadError())
+        self._deleteCount += 1
+        self._invalidateCached((id,))
 
     def purgeDocument(self, id):
-        if not lib.CBLDatabase_PurgeDocumentByID(self._ref, stringParam(id), gError):
-            raise CBLException("Couldn't purge document", gError)
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        purged = lib.CBLDatabase_PurgeDocumentByID(self._ref, stringParam(id), threadError())
+        if stats is not None:
+            stats.since("document.purge", start)
+        if not purged:
+            raise CBLException("Couldn't purge document", threadError())
+        self._deleteCount += 1
+        self._invalidateCached((id,))
 
     def __getitem__(self, id):
         return self.getMutableDocument(id)
@@ -251,40 +646,92 @@ class Database(CBLObject):
     # Batch operations:  (`with db: ...`)
 
     def __enter__(self):
-        if not lib.CBLDatabase_BeginTransaction(self._ref, gError):
-            raise CBLException("Couldn't begin a transaction", gError)
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        begun = lib.CBLDatabase_BeginTransaction(self._ref, threadError())
+        if stats is not None:
+            stats.since("transaction.begin", start)
+        if not begun:
+            raise CBLException("Couldn't begin a transaction", threadError())
+        self._transactions += 1
 
     def __exit__(self, exc_type, exc_value, traceback):
         commit = not exc_type
-        if not lib.CBLDatabase_EndTransaction(self._ref, commit, gError) and commit:
-            raise CBLException("Couldn't commit a transaction", gError)
+        stats = self._stats
+        if stats is not None:
+            start = perf_counter()
+        ended = lib.CBLDatabase_EndTransaction(self._ref, commit, threadError())
+        self._transactions -= 1
+        if stats is not None:
+            stats.since("transaction.commit" if commit else "transaction.abort", start)
+        if not ended and commit:
+            raise CBLException("Couldn't commit a transaction", threadError())
 
     # TODO: Some way to abort the transaction w/o raising an exception
 
     # Expiration:
 
     def getDocumentExpiration(self, id):
-        exp = lib.CBLDatabase_GetDocumentExpiration(self._ref, stringParam(id), gError)
+        exp = lib.CBLDatabase_GetDocumentExpiration(self._ref, stringParam(id), threadError())
         if exp > 0:
             return datetime.fromtimestamp(exp)
         elif exp == 0:
             return None
         else:
-            raise CBLException("Couldn't get document's expiration", gError)
+            raise CBLException("Couldn't get document's expiration", threadError())
 
     def setDocumentExpiration(self, id, expDateTime):
         timestamp = 0
         if expDateTime != None:
             timestamp = math.ceil(expDateTime.timestamp())
         if not lib.CBLDatabase_SetDocumentExpiration(
-            self._ref, stringParam(id), timestamp, gError
+            self._ref, stringParam(id), timestamp, threadError()
         ):
-            raise CBLException("Couldn't set document's expiration", gError)
+            raise CBLException("Couldn't set document's expiration", threadError())
+
+    # Queries:
+
+    queryCacheSize = 64
+
+    def query(self, queryString, language=N1QLLanguage):
+        """Returns a compiled Query, reusing it from a cache of the `queryCacheSize` most recently
+           used ones if this thread has compiled it before on this database. Each thread has its
+           own cache, since a Query's parameters can't be set by two threads at once; still, set
+           them right before executing it, since other code on the thread may share it."""
+        if language == JSONLanguage and not isinstance(queryString, str):
+            queryString = encodeJSON(queryString)
+        key = (queryString, language)
+        query = self._queries.get(key)
+        if query is not None:
+            return query
+        query = Query(self, queryString, language)
+        advisor = self.indexAdvisor
+        if advisor is not None and advisor.observe(query):
+            query = Query(self, queryString, language)  # recompile it to use the new index
+        self._queries.add(key, query, self.queryCacheSize)
+        return query
 
     # Listeners:
 
-    def addListener(self, listener):
-        handle = ffi.new_handle(listener)
+    # The most times per second that buffered listeners are called.
+    notificationRate = 20.0
+
+    def addListener(self, listener, buffered=False, dispatch=None):
+        """Calls `listener` with a list of document IDs after documents change.
+
+           If `buffered` is true, the database switches to buffered-notification mode: the IDs
+           are collected natively, without duplicates, and delivered in batches by a background
+           thread, no more than `notificationRate` times a second. The listener is called on that
+           thread, unless `dispatch` is given, in which case `dispatch(listener, docIDs)` is
+           called instead, e.g. `loop.call_soon_threadsafe` or `executor.submit`. In this mode
+           all of the database's other listeners are called on that thread too. The mode ends
+           when the last buffered listener is removed."""
+        if buffered:
+            if self._changeBuffer is None:
+                self._changeBuffer = _ChangeBuffer(self)
+            return self._changeBuffer.addListener(listener, dispatch)
+        handle = ffi.new_handle(self._countingListener(listener))
         self.listeners.add(handle)
         c_token = lib.CBLDatabase_AddChangeListener(
             self._ref, lib.databaseListenerCallback, handle
@@ -292,7 +739,7 @@ class Database(CBLObject):
         return ListenerToken(self, handle, c_token)
 
     def addDocumentListener(self, docID, listener):
-        handle = ffi.new_handle(listener)
+        handle = ffi.new_handle(self._countingListener(listener))
         self.listeners.add(handle)
         c_token = lib.CBLDatabase_AddDocumentChangeListener(
             self._ref, stringParam(docID), lib.databaseListenerCallback, handle
@@ -303,6 +750,120 @@ class Database(CBLObject):
         token.remove()
 
 
+class _ChangeBuffer:
+    """A database's buffered-notification mode. A background thread waits for CBL to say
+       notifications are ready, sends them, and calls the buffered listeners with the doc IDs
+       that changed, then sleeps long enough to keep within `Database.notificationRate`."""
+
+    def __init__(self, db):
+        self.db = db
+        self.listeners = set()
+        self._native = native.newChangeBuffer(address(db._ref))
+        self._stopped = False
+        self._thread = threading.Thread(target=self._run, name="CBL notifications: " + db.name,
+                                        daemon=True)
+        self._thread.start()
+
+    def addListener(self, listener, dispatch):
+        if dispatch is None:
+            deliver = listener
+        else:
+            deliver = lambda docIDs: dispatch(listener, docIDs)
+        self.listeners.add(deliver)
+        return _BufferedListenerToken(self, deliver)
+
+    def _run(self):
+        while not self._stopped:
+            docIDs = native.waitForChanges(self._native, -1)
+            if self._stopped:
+                break
+            if docIDs:
+                start = time.monotonic()
+                stats = self.db._stats
+                if stats is not None:
+                    stats.count("listener.callbacks", len(self.listeners))
+                    stats.count("listener.docIDs", len(docIDs))
+                for deliver in list(self.listeners):
+                    try:
+                        deliver(docIDs)
+                    except Exception:
+                        traceback.print_exc()
+                delay = start + 1.0 / self.db.notificationRate - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)   # changes meanwhile pile up in CBL, to be sent together
+
+    def close(self):
+        self._stopped = True
+        native.wakeChangeBuffer(self._native)
+        if threading.current_thread() is not self._thread:
+            self._thread.join()
+        self.listeners.clear()
+        self._native = None     # turns off buffering
+
+
+class _BufferedListenerToken (ListenerToken):
+    """Removing the last buffered listener turns buffered-notification mode off again."""
+
+    def __init__(self, changeBuffer, deliver):
+        ListenerToken.__init__(self, changeBuffer, deliver, None)
+
+    def remove(self):
+        changeBuffer = self.owner
+        ListenerToken.remove(self)
+        if changeBuffer is not None and not changeBuffer.listeners:
+            db = changeBuffer.db
+            if db._changeBuffer is changeBuffer:
+                db._changeBuffer = None
+                changeBuffer.close()
+
+
+class DatabasePool:
+    """Several handles open on the same database file, so that reads can run in parallel.
+       Couchbase Lite serializes all calls made on one handle, so threads sharing a single
+       `Database` take turns; each reader handle here can be busy on a different core.
+       All writes go through the one `writer` handle, inside `write()`."""
+
+    def __init__(self, name, config=None, readers=4):
+        if readers < 1:
+            raise ValueError("A DatabasePool needs at least one reader")
+        self.name = name
+        self.writer = Database(name, config)
+        self._writeLock = threading.RLock()
+        self._readers = [Database(name, config) for i in range(readers)]
+        self._idle = queue.Queue()
+        for db in self._readers:
+            self._idle.put(db)
+
+    def __repr__(self):
+        return "DatabasePool['" + self.name + "', " + str(len(self._readers)) + " readers]"
+
+    @contextmanager
+    def reader(self):
+        """Checks out a reader handle for the duration of the `with` block, waiting if all
+           of them are in use. Don't write through it, or keep objects read from it past the
+           block."""
+        db = self._idle.get()
+        try:
+            yield db
+        finally:
+            self._idle.put(db)
+
+    @contextmanager
+    def write(self):
+        """Yields the writer handle inside a transaction that commits at the end of the `with`
+           block (or aborts if it raises.) Writers on other threads wait their turn."""
+        with self._writeLock:
+            with self.writer:
+                yield self.writer
+
+    def close(self):
+        """Closes all the handles. Waits for checked-out readers to be returned first."""
+        for i in range(len(self._readers)):
+            self._idle.get().close()
+        with self._writeLock:
+            self.writer.close()
+
+
 @ffi.def_extern()
 def databaseListenerCallback(context, db, numDocs, c_docIDs):
     docIDs = []
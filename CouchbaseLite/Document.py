@@ -18,6 +18,8 @@
 from ._PyCBL import ffi, lib
 from .common import *
 from .Collections import *
+from .Collections import _decodeTracked
+from time import perf_counter
 import json
 
 # Concurrency control:
@@ -25,6 +27,9 @@ LastWriteWins = 0
 FailOnConflict = 1
 
 class Document (CBLObject):
+    # The Collection the document was read from, or None for the default collection.
+    collection = None
+
     def __init__(self, id):
         self.id = id
         self._ref = None
@@ -34,29 +39,57 @@ class Document (CBLObject):
 
     @staticmethod
     def _get(database, id):
-        ref = lib.CBLDatabase_GetDocument(database._ref, stringParam(id), gError)
+        stats = database._stats
+        if stats is not None:
+            start = perf_counter()
+        ref = lib.CBLDatabase_GetDocument(database._ref, stringParam(id), threadError())
+        if stats is not None:
+            stats.since("document.get", start)
         if not ref or ref == ffi.NULL:
-            if gError.code != 0:
-                raise CBLException("Couldn't get document " + id, gError)
+            if threadError().code != 0:
+                raise CBLException("Couldn't get document " + id, threadError())
             return None
         doc = Document(id)
         doc.database = database
         doc._ref = ref
         return doc
 
+    # Wraps a CBLDocument returned (already retained) by the native module.
+    @staticmethod
+    def _fromAddress(database, id, addr):
+        doc = Document(id)
+        doc.database = database
+        doc._ref = ffi.cast("CBLDocument*", addr)
+        return doc
+
     def delete(self, database, concurrency = LastWriteWins):
         assert(self._ref)
-        if not lib.CBLDatabase_DeleteDocumentWithConcurrencyControl(database._ref, self._ref, concurrency, gError):
-            raise CBLException("Couldn't delete document", gError)
+        if self.collection is not None:
+            deleted = lib.CBLCollection_DeleteDocumentWithConcurrencyControl(self.collection._ref, self._ref,
+                                                                             concurrency, threadError())
+        else:
+            deleted = lib.CBLDatabase_DeleteDocumentWithConcurrencyControl(database._ref, self._ref,
+                                                                           concurrency, threadError())
+        if not deleted:
+            raise CBLException("Couldn't delete document", threadError())
+        database._deleteCount += 1
+        database._invalidateCached((self.id,), self.collection)
 
     def purge(self, database):
         assert(self._ref)
-        if not lib.CBLDatabase_PurgeDocument(database._ref, self._ref, gError):
-            raise CBLException("Couldn't purge document", gError)
+        if self.collection is not None:
+            purged = lib.CBLCollection_PurgeDocument(self.collection._ref, self._ref, threadError())
+        else:
+            purged = lib.CBLDatabase_PurgeDocument(database._ref, self._ref, threadError())
+        if not purged:
+            raise CBLException("Couldn't purge document", threadError())
+        database._deleteCount += 1
+        database._invalidateCached((self.id,), self.collection)
 
     def mutableCopy(self):
         mdoc = MutableDocument(self.id)
         mdoc.database = self.database
+        mdoc.collection = self.collection
         mdoc._ref = lib.CBLDocument_MutableCopy(self._ref)
         return mdoc
 
@@ -70,7 +103,16 @@ class Document (CBLObject):
         if not "_properties" in self.__dict__:
             if self._ref:
                 fleeceProps = lib.CBLDocument_Properties(self._ref)
-                self._properties = decodeFleeceDict(fleeceProps, mutable=self.isMutable)
+                database = self.__dict__.get("database")
+                if self.isMutable:
+                    # Remember which properties change, so saving can update only those
+                    self._properties = self._trackedProperties = _decodeTracked(fleeceProps)
+                elif database is not None and database.lazyProperties:
+                    self._properties = Dictionary(fleece=fleeceProps, owner=self, keys=database._dictKeys)
+                elif database is not None and database._stats is not None:
+                    self._properties = decodeFleece(fleeceProps, stats=database._stats)
+                else:
+                    self._properties = decodeFleeceDict(fleeceProps)
             else:
                 self._properties = {}
         return self._properties
@@ -82,6 +124,14 @@ class Document (CBLObject):
 
     def get(self, key, dflt = None):
         return self.properties.get(key, dflt)
+
+    def getPath(self, path, dflt = None):
+        """Returns the value at a key path like "order.items[3].sku", or `dflt` if there's none.
+           Only the selected value is decoded, unless the properties already have been."""
+        props = self.__dict__.get("_properties")
+        if props is None and self._ref:
+            return evalKeyPath(lib.CBLDocument_Properties(self._ref), path, dflt)
+        return evalKeyPathInPython(self.properties, path, dflt)
     def __getitem__(self, key):
         return self.properties[key]
     def __contains__(self, key):
@@ -102,10 +152,15 @@ class MutableDocument (Document):
 
     @staticmethod
     def _get(database, id):
-        ref = lib.CBLDatabase_GetMutableDocument(database._ref, stringParam(id), gError)
+        stats = database._stats
+        if stats is not None:
+            start = perf_counter()
+        ref = lib.CBLDatabase_GetMutableDocument(database._ref, stringParam(id), threadError())
+        if stats is not None:
+            stats.since("document.get", start)
         if not ref or ref == ffi.NULL:
-            if gError.code != 0:
-                raise CBLException("Couldn't get document " + id, gError)
+            if threadError().code != 0:
+                raise CBLException("Couldn't get document " + id, threadError())
             return None
         doc = MutableDocument(id)
         doc.database = database
@@ -133,12 +188,27 @@ class MutableDocument (Document):
         if not self._ref:
             self._ref = lib.CBLDocument_CreateWithID(stringParam(self.id))
         if "_properties" in self.__dict__:
-            jsonStr = encodeJSON(self._properties)
-            if not lib.CBLDocument_SetJSON(self._ref, stringParam(jsonStr), gError):
-                raise CBLException("Couldn't store properties", gError)
+            if self._properties is self.__dict__.get("_trackedProperties"):
+                encodeFleeceChanges(self._ref, self._properties)
+            else:
+                encodeFleeceProperties(self._ref, self._properties)
+
+    # Called from Database.saveDocuments: returns a `(docID, properties, docAddress)` entry
+    # for the native bulk saver, which does what _prepareToSave would.
+    def _bulkSaveEntry(self):
+        if not self._ref:
+            self._ref = lib.CBLDocument_CreateWithID(stringParam(self.id))
+        props = self.__dict__.get("_properties")
+        if props is not None and props is self.__dict__.get("_trackedProperties"):
+            encodeFleeceChanges(self._ref, props)
+            props = None
+        return (self.id, props, address(self._ref))
 
     def save(self, concurrency = FailOnConflict):
-        self.database.saveDocument(self, concurrency)
+        if self.collection is not None:
+            self.collection.saveDocument(self, concurrency)
+        else:
+            self.database.saveDocument(self, concurrency)
 
     @property
     def isMutable(self):
@@ -0,0 +1,194 @@
+# DocumentCache.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import threading
+from collections import OrderedDict
+
+from ._PyCBL import ffi, lib
+from .common import *
+from .Collections import decodeFleeceDict
+from .Document import Document
+
+
+class FrozenDict (dict):
+    """A dict that can't be modified, used for cached document properties. It's still a dict, so
+       it can be passed to anything that takes one, such as `json.dumps`."""
+
+    def _readOnly(self, *args, **kwargs):
+        raise TypeError("Cached document properties are read-only; use mutableCopy() to change them")
+
+    __setitem__ = __delitem__ = __ior__ = _readOnly
+    clear = pop = popitem = setdefault = update = _readOnly
+
+    def __copy__(self):
+        return self
+
+    def __deepcopy__(self, memo):
+        return self
+
+    def __reduce__(self):
+        return (FrozenDict, (dict(self),))
+
+
+def freeze(value):
+    """Returns an immutable equivalent of a decoded Fleece value: dicts become FrozenDicts and
+       lists become tuples, recursively."""
+    if isinstance(value, dict):
+        return FrozenDict((key, freeze(item)) for key, item in value.items())
+    if isinstance(value, list):
+        return tuple(freeze(item) for item in value)
+    return value
+
+
+class DocumentCache:
+    """An LRU cache of up to `maxDocuments` documents read by `Database.getDocument`, with their
+       properties decoded. Enable it with `Database.enableDocumentCache`.
+
+       Cached documents are shared by every caller, so their properties are frozen: dicts are
+       FrozenDicts and arrays are tuples. Use `mutableCopy()` or `Database.getMutableDocument`
+       to change a document.
+
+       Each entry is keyed by document ID and remembers the document's sequence. A document is
+       dropped from the cache right away when it's written through the Database object or one
+       of its Collections, and when the database's change listener reports that some other
+       writer changed it. A document read while any invalidation happens isn't cached, and a
+       read never replaces a newer sequence.
+
+       The change listener is delayed in buffered-notification mode (`Database.addListener`
+       with `buffered=True`), so while that's on, or if `validate` is true, every hit is
+       checked by getting the document from CBL and comparing its sequence; only the decoding
+       is saved then. Such a hit that turns out to be out of date counts as `stale`."""
+
+    def __init__(self, database, maxDocuments=1000, validate=False):
+        if maxDocuments < 1:
+            raise ValueError("A DocumentCache needs room for at least one document")
+        self.database = database
+        self.maxDocuments = maxDocuments
+        self.validate = validate
+        self.hits = self.misses = self.stale = self.evictions = self.invalidations = 0
+        self._entries = OrderedDict()   # docID -> Document, least recently used first
+        self._lock = threading.Lock()
+        self._epoch = 0                 # incremented by every invalidation
+        self._token = database.addListener(self.invalidateMany)
+
+    def __repr__(self):
+        return "DocumentCache[%s, %d/%d]" % (self.database.name, len(self._entries), self.maxDocuments)
+
+    def __len__(self):
+        return len(self._entries)
+
+    def __contains__(self, id):
+        return id in self._entries
+
+    def get(self, id):
+        """Returns the document with this ID, from the cache if possible; or None if it doesn't
+           exist."""
+        db = self.database
+        stats = db._stats
+        with self._lock:
+            epoch = self._epoch
+            cached = self._entries.get(id)
+            if cached is not None:
+                self._entries.move_to_end(id)
+        ref = None
+        if cached is not None and (self.validate or db._changeBuffer is not None):
+            ref = lib.CBLDatabase_GetDocument(db._ref, stringParam(id), threadError())
+            if ref and lib.CBLDocument_Sequence(ref) == cached.sequence:
+                lib.CBL_Release(ref)
+                ref = None
+            else:
+                cached = None
+                with self._lock:
+                    self.stale += 1
+        if cached is not None:
+            with self._lock:
+                self.hits += 1
+            if stats is not None:
+                stats.count("documentCache.hits")
+            return cached
+        with self._lock:
+            self.misses += 1
+        if stats is not None:
+            stats.count("documentCache.misses")
+
+        if ref is None:
+            doc = Document._get(db, id)
+        elif ref == ffi.NULL:
+            if threadError().code != 0:
+                raise CBLException("Couldn't get document " + id, threadError())
+            self.invalidate(id)
+            return None
+        else:
+            doc = Document(id)
+            doc.database = db
+            doc._ref = ref
+        if doc is None:
+            return None
+        doc._properties = freeze(decodeFleeceDict(lib.CBLDocument_Properties(doc._ref)))
+        evicted = 0
+        with self._lock:
+            if self._epoch != epoch:
+                return doc      # it may already be out of date; don't cache it
+            cached = self._entries.get(id)
+            if cached is not None and cached.sequence > doc.sequence:
+                return cached
+            self._entries[id] = doc
+            self._entries.move_to_end(id)
+            while len(self._entries) > self.maxDocuments:
+                self._entries.popitem(last=False)
+                evicted += 1
+            self.evictions += evicted
+        if evicted and stats is not None:
+            stats.count("documentCache.evictions", evicted)
+        return doc
+
+    def invalidate(self, id):
+        self.invalidateMany((id,))
+
+    def invalidateMany(self, ids):
+        """Drops these document IDs from the cache. The database change listener calls this."""
+        with self._lock:
+            self._epoch += 1
+            for id in ids:
+                if self._entries.pop(id, None) is not None:
+                    self.invalidations += 1
+
+    def clear(self):
+        with self._lock:
+            self._epoch += 1
+            self._entries.clear()
+
+    def stats(self):
+        """Returns the hits, misses (including stale hits), evictions and invalidations so far,
+           and the hit rate."""
+        with self._lock:
+            lookups = self.hits + self.misses
+            return {"size": len(self._entries), "maxDocuments": self.maxDocuments,
+                    "hits": self.hits, "misses": self.misses, "stale": self.stale,
+                    "evictions": self.evictions, "invalidations": self.invalidations,
+                    "hitRate": self.hits / lookups if lookups else 0.0}
+
+    def resetStats(self):
+        with self._lock:
+            self.hits = self.misses = self.stale = self.evictions = self.invalidations = 0
+
+    def close(self):
+        """Removes the change listener and empties the cache."""
+        if self._token is not None:
+            self._token.remove()
+            self._token = None
+        self.clear()
@@ -0,0 +1,227 @@
+# IndexAdvisor.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import re
+from collections import OrderedDict
+
+from .Collection import DefaultScopeName, DefaultCollectionName
+from .Database import IndexConfiguration
+from .Query import N1QLLanguage
+
+# Operators in the JSON query schema that an index can answer, with a property on one side and
+# a constant or parameter on the other:
+_kEqualityOps = {"=", "==", "IS", "IN"}
+_kRangeOps = {"<", "<=", ">", ">=", "BETWEEN", "LIKE"}
+
+_kIdentifier = re.compile(r"^[A-Za-z_][A-Za-z0-9_]*$")
+
+
+def _propertyPath(expr):
+    """Returns the property path (like "address.city") a JSON query expression refers to, if it's
+       a property reference like [".address.city"] or [".", "address", "city"]; else None."""
+    if not (isinstance(expr, list) and expr and isinstance(expr[0], str) and expr[0].startswith(".")):
+        return None
+    parts = [expr[0][1:]] + [part for part in expr[1:] if isinstance(part, str)]
+    return ".".join(part for part in parts if part) or None
+
+
+def _isConstant(expr):
+    if isinstance(expr, list):
+        if not expr:
+            return True
+        if isinstance(expr[0], str) and (expr[0].startswith(".") or expr[0].startswith("?")):
+            return False    # a property or variable
+        if isinstance(expr[0], str) and expr[0].startswith("$"):
+            return True     # a parameter
+        return all(_isConstant(item) for item in expr[1:])
+    if isinstance(expr, dict):
+        return all(_isConstant(value) for value in expr.values())
+    return True
+
+
+class _QueryShape:
+    """The parts of a JSON query that matter for indexing: the collection it reads, the
+       properties it compares to constants (equality first, then ranges), and ORDER BY's."""
+
+    def __init__(self, query):
+        self.scope, self.collection, aliases = DefaultScopeName, DefaultCollectionName, set()
+        for source in query.get("FROM") or []:
+            if not isinstance(source, dict):
+                continue
+            if "AS" in source:
+                aliases.add(source["AS"])
+            if "JOIN" in source:
+                continue
+            collection = source.get("COLLECTION")
+            if collection and collection not in ("_", DefaultCollectionName):
+                aliases.add(collection)
+                if "." in collection and "SCOPE" not in source:
+                    self.scope, self.collection = collection.split(".", 1)
+                else:
+                    self.scope, self.collection = source.get("SCOPE", DefaultScopeName), collection
+        self._aliases = aliases
+        self.equalities, self.ranges, self.orderBy = [], [], []
+        self._addConditions(query.get("WHERE"))
+        for item in query.get("ORDER_BY") or []:
+            if isinstance(item, list) and len(item) == 2 and item[0] in ("ASC", "DESC"):
+                item = item[1]
+            path = self._path(item)
+            if path:
+                self.orderBy.append(path)
+
+    def _path(self, expr):
+        path = _propertyPath(expr)
+        if path is None:
+            return None
+        first, _, rest = path.partition(".")
+        if first in self._aliases and rest:
+            path, first = rest, rest.partition(".")[0]
+        if first.startswith("_"):
+            return None     # meta().id and the like, which are already indexed
+        return path
+
+    def _addConditions(self, expr):
+        if not (isinstance(expr, list) and expr and isinstance(expr[0], str)):
+            return
+        op = expr[0].upper()
+        if op == "AND":
+            for term in expr[1:]:
+                self._addConditions(term)
+        elif op in _kEqualityOps or op in _kRangeOps:
+            paths = [self._path(operand) for operand in expr[1:]]
+            properties = [path for path in paths if path]
+            others = [operand for operand, path in zip(expr[1:], paths) if not path]
+            if len(properties) == 1 and all(_isConstant(operand) for operand in others):
+                (self.equalities if op in _kEqualityOps else self.ranges).append(properties[0])
+
+    @property
+    def indexColumns(self):
+        """Equality properties, then the first range property, then (if it doesn't conflict with
+           the range) the ORDER BY properties, so that one index can serve all of them."""
+        columns = self.equalities + self.ranges[:1]
+        if not self.ranges or (self.orderBy and self.orderBy[0] == self.ranges[0]):
+            columns += self.orderBy
+        return list(OrderedDict.fromkeys(columns))
+
+
+def _n1qlPath(path):
+    return ".".join(part if _kIdentifier.match(part) else "`" + part.replace("`", "``") + "`"
+                    for part in path.split("."))
+
+
+class IndexSuggestion:
+    """A value index that would help some of the queries an IndexAdvisor has seen. `reasons`
+       says what it would avoid: "full scan" and/or "sort"."""
+
+    def __init__(self, scope, collection, expressions):
+        self.scope = scope
+        self.collection = collection
+        self.expressions = expressions
+        self.name = "auto_" + "_".join(re.sub(r"\W", "_", path) for path in expressions)
+        self.queries = []
+        self.reasons = set()
+        self.created = False
+
+    def __repr__(self):
+        return "IndexSuggestion[%s.%s: %s]" % (self.scope, self.collection, ", ".join(self.expressions))
+
+    @property
+    def config(self):
+        return IndexConfiguration(N1QLLanguage, ", ".join(_n1qlPath(path) for path in self.expressions))
+
+    def create(self, database):
+        """Creates the index. Returns false, creating nothing, if the collection no longer
+           exists."""
+        if self.scope == DefaultScopeName and self.collection == DefaultCollectionName:
+            database.createIndex(self.name, self.config)
+        else:
+            coll = database.collection(self.collection, self.scope, create=False)
+            if coll is None:
+                return False
+            coll.createIndex(self.name, self.config)
+        self.created = True
+        return True
+
+
+class IndexAdvisor:
+    """Looks at the plans of queries, and suggests value indexes for the ones that scan a whole
+       collection or sort their results without an index. It bases each suggestion on the
+       properties the query's WHERE clause compares to constants or parameters (through AND)
+       and its ORDER BY properties.
+
+       Attached to a database, it sees every query compiled by `Database.query`. In `autoCreate`
+       mode it creates each index it suggests, and `Database.query` recompiles the query to use
+       it. Queries on collections with fewer than `minDocuments` documents are ignored."""
+
+    def __init__(self, database, autoCreate=False, minDocuments=0, attach=True):
+        self.database = database
+        self.autoCreate = autoCreate
+        self.minDocuments = minDocuments
+        self.queriesSeen = 0
+        self._suggestions = OrderedDict()
+        if attach:
+            database.indexAdvisor = self
+
+    def __repr__(self):
+        return "IndexAdvisor[" + self.database.name + "]"
+
+    def detach(self):
+        if self.database.indexAdvisor is self:
+            self.database.indexAdvisor = None
+
+    def _count(self, scope, collection):
+        if scope == DefaultScopeName and collection == DefaultCollectionName:
+            return self.database.count
+        coll = self.database.collection(collection, scope, create=False)
+        return coll.count if coll is not None else 0
+
+    def observe(self, query):
+        """Analyzes a compiled Query. Returns true if it created an index for it, in which case
+           the query has to be compiled again to use it."""
+        self.queriesSeen += 1
+        plan = query.plan
+        if plan.query is None or not (plan.fullScans or plan.sortsWithoutIndex):
+            return False
+        shape = _QueryShape(plan.query)
+        columns = shape.indexColumns
+        if not columns:
+            return False
+        if self.minDocuments and self._count(shape.scope, shape.collection) < self.minDocuments:
+            return False
+        key = (shape.scope, shape.collection, tuple(columns))
+        suggestion = self._suggestions.get(key)
+        if suggestion is None:
+            suggestion = self._suggestions[key] = IndexSuggestion(shape.scope, shape.collection, columns)
+        if query.sourceCode not in suggestion.queries:
+            suggestion.queries.append(query.sourceCode)
+        if plan.fullScans:
+            suggestion.reasons.add("full scan")
+        if plan.sortsWithoutIndex:
+            suggestion.reasons.add("sort")
+        if self.autoCreate and not suggestion.created:
+            return suggestion.create(self.database)
+        return False
+
+    def suggestions(self):
+        """The suggested indexes that haven't been created, most-needed (by number of queries)
+           first."""
+        pending = [s for s in self._suggestions.values() if not s.created]
+        return sorted(pending, key=lambda s: len(s.queries), reverse=True)
+
+    @property
+    def created(self):
+        return [s for s in self._suggestions.values() if s.created]
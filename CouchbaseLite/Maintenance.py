@@ -0,0 +1,241 @@
+# Maintenance.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import collections
+import threading
+import time
+import traceback
+
+from ._PyCBL import lib
+
+# Maintenance types, for `Database.performMaintenance`:
+Compact = lib.kCBLMaintenanceTypeCompact
+Reindex = lib.kCBLMaintenanceTypeReindex
+IntegrityCheck = lib.kCBLMaintenanceTypeIntegrityCheck
+Optimize = lib.kCBLMaintenanceTypeOptimize
+FullOptimize = lib.kCBLMaintenanceTypeFullOptimize
+
+MaintenanceNames = {Compact: "compact", Reindex: "reindex", IntegrityCheck: "integrityCheck",
+                    Optimize: "optimize", FullOptimize: "fullOptimize"}
+
+
+class MaintenanceReport:
+    """The result of one maintenance run: when it started (a `time.time()` value), how many
+       seconds it took, the database's file size before and after, and the number of writes
+       and deletes since the previous run of that type. `error` is the exception if it failed."""
+
+    def __init__(self, type, started, seconds, sizeBefore, sizeAfter, writes, deletes, error=None):
+        self.type = type
+        self.started = started
+        self.seconds = seconds
+        self.sizeBefore = sizeBefore
+        self.sizeAfter = sizeAfter
+        self.writes = writes
+        self.deletes = deletes
+        self.error = error
+
+    def __repr__(self):
+        return "MaintenanceReport[%s, %.3fs, %d -> %d bytes%s]" % (
+            self.name, self.seconds, self.sizeBefore, self.sizeAfter, ", failed" if self.error else "")
+
+    @property
+    def name(self):
+        return MaintenanceNames[self.type]
+
+    def asDict(self):
+        return {"type": self.name, "started": self.started, "seconds": self.seconds,
+                "sizeBefore": self.sizeBefore, "sizeAfter": self.sizeAfter,
+                "writes": self.writes, "deletes": self.deletes,
+                "error": str(self.error) if self.error else None}
+
+
+class MaintenanceScheduler:
+    """Runs optimize and compact on a database when enough has changed, while it's idle.
+
+       It counts the documents saved and deleted (or purged) through the Database object. An
+       optimize is due after `optimizeAfterWrites` saves and deletes; a compact after
+       `compactAfterDeletes` deletes, or `compactAfterWrites` saves and deletes; a full
+       optimize, if `fullOptimizeAfterWrites` isn't None, after that many. A background thread
+       checks every `checkInterval` seconds, and runs whatever's due once nothing has been
+       written for `idleTime` seconds and no transaction is open.
+
+       Maintenance can't be interrupted, so the time budget is enforced up front: a run is only
+       started if the time spent in the last `budgetPeriod` seconds, plus the time the previous
+       run of the same type took, fits in `timeBudget` seconds.
+
+       Writes made through another Database object, or by a replicator, aren't seen; call
+       `noteWrites` to account for them. Each run's MaintenanceReport is added to `history`,
+       and passed to `onReport` if that's given."""
+
+    def __init__(self, database,
+                 optimizeAfterWrites=10000,
+                 compactAfterDeletes=5000,
+                 compactAfterWrites=100000,
+                 fullOptimizeAfterWrites=None,
+                 idleTime=5.0,
+                 checkInterval=1.0,
+                 timeBudget=60.0,
+                 budgetPeriod=3600.0,
+                 onReport=None,
+                 historySize=100):
+        self.database = database
+        self.optimizeAfterWrites = optimizeAfterWrites
+        self.compactAfterDeletes = compactAfterDeletes
+        self.compactAfterWrites = compactAfterWrites
+        self.fullOptimizeAfterWrites = fullOptimizeAfterWrites
+        self.idleTime = idleTime
+        self.checkInterval = checkInterval
+        self.timeBudget = timeBudget
+        self.budgetPeriod = budgetPeriod
+        self.onReport = onReport
+        self.history = collections.deque(maxlen=historySize)
+        self._lock = threading.RLock()
+        self._extraWrites = self._extraDeletes = 0
+        counts = self._counts()
+        self._baselines = {Optimize: counts, FullOptimize: counts, Compact: counts}
+        self._lastCounts = counts
+        self._lastActivity = time.monotonic()
+        self._durations = {}            # type -> seconds its last run took
+        self._spent = collections.deque()   # (monotonic end time, seconds) of recent runs
+        self._thread = None
+        self._stop = threading.Event()
+
+    def __repr__(self):
+        return "MaintenanceScheduler[" + self.database.name + "]"
+
+    def _counts(self):
+        db = self.database
+        return (db._writeCount + self._extraWrites, db._deleteCount + self._extraDeletes)
+
+    def noteWrites(self, writes=0, deletes=0):
+        """Counts writes and deletes made some other way than through the Database object."""
+        with self._lock:
+            self._extraWrites += writes
+            self._extraDeletes += deletes
+
+    @property
+    def pending(self):
+        """The (writes, deletes) since the last run of each type, by name."""
+        with self._lock:
+            writes, deletes = self._counts()
+            return {MaintenanceNames[type]: (writes - w, deletes - d)
+                    for type, (w, d) in self._baselines.items()}
+
+    def due(self):
+        """Returns the maintenance types whose thresholds have been reached, most thorough first."""
+        with self._lock:
+            writes, deletes = self._counts()
+            def changes(type):
+                w, d = self._baselines[type]
+                return writes - w, deletes - d
+            result = []
+            if self.fullOptimizeAfterWrites is not None and sum(changes(FullOptimize)) >= self.fullOptimizeAfterWrites:
+                result.append(FullOptimize)
+            w, d = changes(Compact)
+            if d >= self.compactAfterDeletes or (self.compactAfterWrites is not None and w + d >= self.compactAfterWrites):
+                result.append(Compact)
+            if FullOptimize not in result and sum(changes(Optimize)) >= self.optimizeAfterWrites:
+                result.append(Optimize)
+            return result
+
+    def isIdle(self):
+        """True if nothing has been written for `idleTime` seconds and no transaction is open."""
+        with self._lock:
+            now = time.monotonic()
+            counts = self._counts()
+            if counts != self._lastCounts:
+                self._lastCounts = counts
+                self._lastActivity = now
+            return self.database._transactions == 0 and now - self._lastActivity >= self.idleTime
+
+    def budgetLeft(self):
+        """Seconds of maintenance that can still be spent in the current budget period."""
+        with self._lock:
+            horizon = time.monotonic() - self.budgetPeriod
+            while self._spent and self._spent[0][0] < horizon:
+                self._spent.popleft()
+            return self.timeBudget - sum(seconds for _, seconds in self._spent)
+
+    def check(self):
+        """Runs whatever maintenance is due, if the database is idle and the budget allows.
+           Returns the reports of the runs. The background thread calls this periodically."""
+        reports = []
+        for type in self.due():
+            if not self.isIdle():
+                break
+            left = self.budgetLeft()
+            if left <= 0 or self._durations.get(type, 0.0) > left:
+                continue
+            reports.append(self.run(type))
+        return reports
+
+    def run(self, type):
+        """Runs one kind of maintenance now, regardless of thresholds, and returns its report."""
+        db = self.database
+        with self._lock:
+            writes, deletes = self._counts()
+            w, d = self._baselines.get(type, (writes, deletes))
+            sizeBefore = db.fileSize
+            started = time.time()
+            start = time.monotonic()
+            error = None
+            try:
+                db.performMaintenance(type)
+            except Exception as x:
+                error = x
+            end = time.monotonic()
+            seconds = end - start
+            report = MaintenanceReport(type, started, seconds, sizeBefore, db.fileSize,
+                                       writes - w, deletes - d, error)
+            self._durations[type] = seconds
+            self._spent.append((end, seconds))
+            if error is None:
+                self._baselines[type] = (writes, deletes)
+                if type == FullOptimize:
+                    self._baselines[Optimize] = (writes, deletes)
+            self.history.append(report)
+        if self.onReport is not None:
+            self.onReport(report)
+        return report
+
+    # Background thread:
+
+    def start(self):
+        """Starts checking in a background thread. `Database.close` stops it."""
+        if self._thread is None:
+            self._stop.clear()
+            self._thread = threading.Thread(target=self._run, daemon=True,
+                                            name="CBL maintenance: " + self.database.name)
+            self._thread.start()
+            self.database._maintenance = self
+        return self
+
+    def stop(self):
+        if self._thread is not None:
+            self._stop.set()
+            if threading.current_thread() is not self._thread:
+                self._thread.join()
+            self._thread = None
+            if self.database._maintenance is self:
+                self.database._maintenance = None
+
+    def _run(self):
+        while not self._stop.wait(self.checkInterval):
+            try:
+                self.check()
+            except Exception:
+                traceback.print_exc()
@@ -16,10 +16,15 @@
 #
 
 from ._PyCBL import ffi, lib
+from . import _PyCBLNative as native
 from .common import *
 from .Collections import *
-from .Document import MutableDocument
+from .Collections import _blobFromFleece
+from .QueryPlan import QueryPlan
+from time import perf_counter
 import json
+import threading
+from collections import OrderedDict
 
 JSONLanguage = lib.kCBLJSONLanguage
 N1QLLanguage = lib.kCBLN1QLLanguage
@@ -31,13 +36,18 @@ class Query (CBLObject):
 
     def __init__(self, database, queryString, language = N1QLLanguage):
         errorPos = ffi.new("int*")
+        stats = database._stats
+        if stats is not None:
+            start = perf_counter()
         CBLObject.__init__(self,
                            lib.CBLDatabase_CreateQuery(database._ref,
                                                        language, 
                                                        stringParam(queryString),
                                                        errorPos, 
-                                                       gError),
-                           "Couldn't create query", gError)
+                                                       threadError()),
+                           "Couldn't create query", threadError())
+        if stats is not None:
+            stats.since("query.compile", start)
         self.database = database
         self.columnCount = lib.CBLQuery_ColumnCount(self._ref)
         self.sourceCode = queryString
@@ -50,6 +60,12 @@ class Query (CBLObject):
     def explanation(self):
         return sliceToString(lib.CBLQuery_Explain(self._ref))
 
+    @property
+    def plan(self):
+        """The explanation parsed into a QueryPlan: tables scanned, indexes used, full scans and
+           temporary B-trees."""
+        return QueryPlan(self.explanation)
+
     @property
     def columnNames(self):
         if not "_columns" in self.__dict__:
@@ -61,16 +77,29 @@ class Query (CBLObject):
         return self._columns
 
     def setParameters(self, params):
-        doc = MutableDocument("foo")
-        doc.setProperties(params)
-        doc._prepareToSave()
-        lib.CBLQuery_SetParameters(self._ref, lib.CBLDocument_Properties(doc._ref))
+        """Sets the values of the query's `$`-prefixed parameters, from a dict."""
+        if not isinstance(params, dict):
+            raise TypeError("Query parameters must be a dict")
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        fleeceDoc = ffi.gc(ffi.cast("FLDoc", native.encodeDocument(params)), lib.FLDoc_Release)
+        if stats is not None:
+            stats.since("fleece.encode", start)
+            stats.count("fleece.encode.bytes", lib.FLDoc_GetData(fleeceDoc).size)
+        lib.CBLQuery_SetParameters(self._ref, lib.FLValue_AsDict(lib.FLDoc_GetRoot(fleeceDoc)))
+        self._parameters = fleeceDoc     # keep the encoded data alive as long as it's in use
 
     def execute(self):
         """Executes the query and returns a Generator of QueryResult objects."""
-        results = lib.CBLQuery_Execute(self._ref, gError)
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        results = lib.CBLQuery_Execute(self._ref, threadError())
+        if stats is not None:
+            stats.since("query.execute", start)
         if not results:
-            raise CBLException("Query failed", gError)
+            raise CBLException("Query failed", threadError())
         try:
             lastResult = None
             while lib.CBLResultSet_Next(results):
@@ -81,18 +110,133 @@ class Query (CBLObject):
         finally:
             lib.CBL_Release(results)
 
+    def executeColumnar(self):
+        """Executes the query and returns all the results at once, as a dict mapping each column
+           name to a column of values in row order. A column whose values are all integers, all
+           numbers, or all booleans is an `array.array` (typecode 'q', 'd' or 'b'), which
+           supports the buffer protocol, e.g. `numpy.frombuffer(col, dtype=col.typecode)`.
+           Any other column, including one with a null or missing value, is a list."""
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        columns = native.executeColumnar(address(self._ref), _blobFromFleece, address(threadError()))
+        if stats is not None:
+            stats.since("query.executeColumnar", start)
+        if columns is None:
+            raise CBLException("Query failed", threadError())
+        return dict(zip(self.columnNames, columns))
+
     # Listeners:
 
     def addListener(self, listener):
-        handle = ffi.new_handle(listener)
+        handle = ffi.new_handle(self.database._countingListener(listener))
         self.listeners.add(handle)
         c_token = lib.CBLQuery_AddChangeListener(self._ref, lib.queryListenerCallback, handle)
         return ListenerToken(self, handle, c_token)
 
+    def addResultsListener(self, listener, key=0, dispatch=None):
+        """Makes this a live query: whenever its results change, `listener` is called with a
+           QueryChange holding the new results and the rows added, changed and removed since the
+           last call. Rows are matched up by the value of the column `key` (an index or name),
+           such as `meta().id`, which should be unique. The first call has every row as added.
+
+           Only new and changed rows are decoded; unchanged rows are reused. The listener is
+           called on a CBL thread, unless `dispatch` is given, in which case
+           `dispatch(listener, change)` is called instead, e.g. `loop.call_soon_threadsafe`."""
+        if isinstance(key, str):
+            if key not in self.columnNames:
+                raise KeyError("No such column in Query")
+            key = self.columnNames.index(key)
+        elif not 0 <= key < self.columnCount:
+            raise IndexError("Column index out of range")
+        handle = ffi.new_handle(_LiveResults(self, listener, key, dispatch))
+        self.listeners.add(handle)
+        c_token = lib.CBLQuery_AddChangeListener(self._ref, lib.liveQueryListenerCallback, handle)
+        return ListenerToken(self, handle, c_token)
+
     def removeListener(self, token):
         token.remove()
 
 
+class QueryChange (object):
+    """A live query's new results, and how they differ from the previous ones. `rows` is the
+       result set, a list of tuples in result order. `added` and `changed` map the keys of new
+       and modified rows to those rows; `removed` maps the keys of rows that are gone to their
+       previous values.
+
+       Rows that didn't change are the same tuples as in the previous QueryChange, so they must
+       not be modified. If getting the results failed, `error` is a CBLException, `rows` are the
+       previous results, and nothing is added, changed or removed."""
+    def __init__(self, query, rows, added, changed, removed, error=None):
+        self.query = query
+        self.rows = rows
+        self.added = added
+        self.changed = changed
+        self.removed = removed
+        self.error = error
+
+    def __repr__(self):
+        return "QueryChange[%d rows, +%d ~%d -%d]" % (len(self.rows), len(self.added),
+                                                     len(self.changed), len(self.removed))
+
+    def __len__(self):
+        return len(self.rows)
+
+    def __iter__(self):
+        return iter(self.rows)
+
+    @property
+    def columnNames(self):
+        return self.query.columnNames
+
+    def asDictionaries(self):
+        """The rows as dicts mapping column names to values."""
+        names = self.columnNames
+        return [dict(zip(names, row)) for row in self.rows]
+
+
+class _LiveResults (object):
+    """The state of a live query listener: the previous results, keyed by row, to diff with."""
+    def __init__(self, query, listener, keyColumn, dispatch):
+        self.query = query
+        self.keyColumn = keyColumn
+        self.rows = []
+        self.current = {}       # key -> (Fleece encoding, row)
+        self._lock = threading.Lock()
+        if dispatch is None:
+            self.deliver = query.database._countingListener(listener)
+        else:
+            self.deliver = query.database._countingListener(lambda change: dispatch(listener, change))
+
+    def update(self, c_token):
+        with self._lock:
+            query = self.query
+            stats = query.database._stats
+            if stats is not None:
+                start = perf_counter()
+            results = lib.CBLQuery_CopyCurrentResults(query._ref, c_token, threadError())
+            if not results:
+                change = QueryChange(query, self.rows, {}, {}, {},
+                                     CBLException("Couldn't get live query results", threadError()))
+            else:
+                try:
+                    rows, current, added, changed, removed = native.diffResults(
+                        address(results), self.keyColumn, self.current, _blobFromFleece)
+                finally:
+                    lib.CBL_Release(results)
+                previous = self.current
+                change = QueryChange(query, rows,
+                                     {key: current[key][1] for key in added},
+                                     {key: current[key][1] for key in changed},
+                                     {key: previous[key][1] for key in removed})
+                self.rows, self.current = rows, current
+                if stats is not None:
+                    stats.since("query.liveUpdate", start)
+                    stats.count("query.live.rowsDecoded", len(added) + len(changed))
+                    stats.count("query.live.rowsReused", len(current) - len(added) - len(changed))
+        self.deliver(change)
+
+
 class JSONQuery (Query):
     def __init__(self, database, jsonQuery):
         if not isinstance(jsonQuery, str):
@@ -105,6 +249,34 @@ class N1QLQuery (Query):
         Query.__init__(self, database, n1ql, N1QLLanguage)
 
 
+class _QueryCache (object):
+    """The compiled queries cached by `Database.query`: an LRU cache per thread, since a Query's
+       parameters are set on the shared CBLQuery, so two threads can't run the same one at once.
+       (A thread ID may be reused by a new thread, which is harmless: the old one is gone.)"""
+    def __init__(self):
+        self._threads = {}      # thread ID -> OrderedDict of (queryString, language) -> Query
+        self._lock = threading.Lock()
+
+    def get(self, key):
+        with self._lock:
+            queries = self._threads.get(threading.get_ident())
+            query = queries.get(key) if queries is not None else None
+            if query is not None:
+                queries.move_to_end(key)
+            return query
+
+    def add(self, key, query, maxSize):
+        with self._lock:
+            queries = self._threads.setdefault(threading.get_ident(), OrderedDict())
+            queries[key] = query
+            if len(queries) > maxSize:
+                queries.popitem(last=False)
+
+    def clear(self):
+        with self._lock:
+            self._threads.clear()
+
+
 class QueryResult (object):
     """A container representing a query result. It can be indexed using either
        integers (to access columns in the order they were declared in the query)
@@ -139,7 +311,7 @@ class QueryResult (object):
         else:
             # TODO: Handle slices
             raise KeyError("invalid query result key")
-        return decodeFleece(item)
+        return decodeFleece(item, stats=self.query.database._stats)
 
     def __contains__(self, key):
         if self._ref == None:
@@ -154,10 +326,10 @@ class QueryResult (object):
             return False
 
     def asArray(self):
-        return decodeFleece(lib.CBLResultSet_ResultArray(self._ref))
+        return decodeFleece(lib.CBLResultSet_ResultArray(self._ref), stats=self.query.database._stats)
 
     def asDictionary(self):
-        return decodeFleece(lib.CBLResultSet_ResultDict(self._ref))
+        return decodeFleece(lib.CBLResultSet_ResultDict(self._ref), stats=self.query.database._stats)
 
 
 def createIndex(database, name, index_spec):
@@ -167,21 +339,21 @@ def createIndex(database, name, index_spec):
         index_spec = index_spec._cblConfig()
     
     if type == ValueIndex:
-        success = lib.CBLDatabase_CreateValueIndex(database._ref, stringParam(name), index_spec[0], gError)
+        success = lib.CBLDatabase_CreateValueIndex(database._ref, stringParam(name), index_spec[0], threadError())
 
     elif type == FullTextIndex:
-        success = lib.CBLDatabase_CreateFullTextIndex(database._ref, stringParam(name), index_spec[0], gError)
+        success = lib.CBLDatabase_CreateFullTextIndex(database._ref, stringParam(name), index_spec[0], threadError())
 
     else:
         success = None
 
     if not success:
-        raise CBLException("Index creation failed", gError)
+        raise CBLException("Index creation failed", threadError())
 
 def deleteIndex(database, name):    
-    success = lib.CBLDatabase_DeleteIndex(database._ref, stringParam(name), gError)
+    success = lib.CBLDatabase_DeleteIndex(database._ref, stringParam(name), threadError())
     if not success:
-        raise CBLException("Index deletion failed", gError)
+        raise CBLException("Index deletion failed", threadError())
 
 # TODO - this is returning an empty array
 def listIndexNames(database):    
@@ -224,3 +396,7 @@ class IndexSpec:
 def queryListenerCallback(context, query):
     listener = ffi.from_handle(context)
     listener()
+
+@ffi.def_extern()
+def liveQueryListenerCallback(context, query, token):
+    ffi.from_handle(context).update(token)
@@ -0,0 +1,121 @@
+# QueryPlan.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import json
+import re
+
+# `CBLQuery_Explain` returns the SQL the query was translated to, then SQLite's query plan as
+# lines of "id|parent|notused|detail", then the query in JSON form, separated by blank lines.
+_kPlanLine = re.compile(r"^(\d+)\|(\d+)\|\d+\|\s?(.*)$")
+
+# Plan details look like "SCAN TABLE kv_default AS _doc", "SCAN _doc" (newer SQLite),
+# "SEARCH _doc USING INDEX byName (<expr>=?)", "SCAN _doc USING COVERING INDEX byName",
+# or "USE TEMP B-TREE FOR ORDER BY".
+_kScan = re.compile(r"^(SCAN|SEARCH)(?: TABLE)? (\S+)(?: AS (\S+))?"
+                    r"(?: USING (?:(COVERING) )?(?:INDEX (\S+)|(INTEGER PRIMARY KEY|PRIMARY KEY|AUTOMATIC)))?")
+_kTempBTree = re.compile(r"^USE TEMP B-TREE FOR (.*)$")
+
+
+class PlanStep:
+    """One line of a SQLite query plan. `kind` is "scan", "search", "tempBTree" or "other"."""
+
+    def __init__(self, id, parent, detail):
+        self.id = id
+        self.parent = parent
+        self.detail = detail
+        self.kind = "other"
+        self.table = self.alias = self.index = None
+        self.covering = False
+        self.tempBTreeFor = None
+        m = _kScan.match(detail)
+        if m:
+            self.kind = m.group(1).lower()
+            self.table = m.group(2)
+            self.alias = m.group(3) or m.group(2)
+            self.covering = m.group(4) is not None
+            self.index = m.group(5) or m.group(6)
+        else:
+            m = _kTempBTree.match(detail)
+            if m:
+                self.kind = "tempBTree"
+                self.tempBTreeFor = m.group(1)
+
+    def __repr__(self):
+        return "PlanStep[" + self.detail + "]"
+
+    @property
+    def isFullScan(self):
+        """True if this step reads every row of a table, without any index."""
+        return self.kind == "scan" and self.index is None
+
+
+class QueryPlan:
+    """A parsed `Query.explanation`: the SQL, the plan steps, and the query as JSON (a dict, or
+       None if it couldn't be parsed.) Get one from `Query.plan`."""
+
+    def __init__(self, explanation):
+        self.explanation = explanation
+        self.steps = []
+        self.query = None
+        sql = []
+        for line in explanation.splitlines():
+            m = _kPlanLine.match(line)
+            if m:
+                self.steps.append(PlanStep(int(m.group(1)), int(m.group(2)), m.group(3)))
+            elif line.startswith("{") and self.steps:
+                try:
+                    self.query = json.loads(line)
+                except ValueError:
+                    pass
+            elif not self.steps and line.strip():
+                sql.append(line)
+        self.sql = "\n".join(sql)
+
+    def __repr__(self):
+        return "QueryPlan" + repr([step.detail for step in self.steps])
+
+    @property
+    def tablesScanned(self):
+        """The tables (or aliases, in newer SQLite) read by each scan or search step."""
+        return [step.table for step in self.steps if step.kind in ("scan", "search")]
+
+    @property
+    def indexesUsed(self):
+        return [step.index for step in self.steps
+                if step.index is not None and step.index not in ("INTEGER PRIMARY KEY", "PRIMARY KEY")]
+
+    @property
+    def fullScans(self):
+        """The steps that read a whole table without an index."""
+        return [step for step in self.steps if step.isFullScan]
+
+    @property
+    def tempBTrees(self):
+        """What temporary B-trees are built for, e.g. "ORDER BY" or "DISTINCT"."""
+        return [step.tempBTreeFor for step in self.steps if step.kind == "tempBTree"]
+
+    @property
+    def sortsWithoutIndex(self):
+        """True if the results have to be sorted after they're found, for ORDER BY."""
+        return any("ORDER BY" in what for what in self.tempBTrees)
+
+    def summary(self):
+        """A dict suitable for logging or JSON."""
+        return {"tablesScanned": self.tablesScanned,
+                "indexesUsed": self.indexesUsed,
+                "fullScans": [step.alias for step in self.fullScans],
+                "tempBTrees": self.tempBTrees}
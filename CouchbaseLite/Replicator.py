@@ -1,5 +1,126 @@
 from ._PyCBL import ffi, lib
+from . import _PyCBLNative as native
 from .common import *
+from .Document import Document
+from collections import namedtuple
+import threading
+import time
+import traceback
+import weakref
+
+# Replicator types:
+PushAndPull = 0
+Push = 1
+Pull = 2
+
+# Activity levels:
+Stopped = 0
+Offline = 1
+Connecting = 2
+Idle = 3
+Busy = 4
+
+ActivityNames = ("stopped", "offline", "connecting", "idle", "busy")
+
+# Document flags passed to filters and in ReplicatedDocuments:
+DocumentFlagsDeleted = 1
+DocumentFlagsAccessRemoved = 2
+
+# Rule kinds understood by `_PyCBLNative.newReplicationFilter`:
+_kRuleDocIDs = 0
+_kRuleIDPrefix = 1
+_kRuleEquals = 2
+_kRuleIn = 3
+_kRuleExists = 4
+_kRuleDeleted = 5
+
+
+class ReplicationFilter:
+    """A push or pull filter made of declarative rules, which are evaluated natively on the
+       replicator's thread, so filtering doesn't need the GIL. A document passes if every rule
+       does. The rule methods return the filter, so they can be chained:
+
+           ReplicationFilter().idPrefix("order:").equals("status", "open").exists("total")
+
+       Key paths are like "address.city" or "items[0].sku". A deleted document has no
+       properties, so it fails property rules; use `passDeletions=True` to let deletions (and
+       access removals) through regardless of the rules.
+
+       A Python `callback(document, flags)` can be added too; it's only called for documents
+       that pass the rules, and it does need the GIL, so use it only for what the rules can't
+       express."""
+
+    def __init__(self, passDeletions=False, callback=None):
+        self.passDeletions = passDeletions
+        self.rules = []
+        self._callback = callback
+        self._compiled = None
+        self._compiledFor = None
+        self._handles = []
+
+    def __repr__(self):
+        return "ReplicationFilter" + repr(self.rules)
+
+    def _add(self, kind, negate, path, value):
+        self.rules.append((kind, negate, path, value))
+        self._compiled = None
+        return self
+
+    def docIDs(self, ids, negate=False):
+        """The document's ID must be one of `ids`."""
+        return self._add(_kRuleDocIDs, negate, None, {id: True for id in ids})
+
+    def idPrefix(self, *prefixes, negate=False):
+        """The document's ID must start with one of the `prefixes`."""
+        return self._add(_kRuleIDPrefix, negate, None, list(prefixes))
+
+    def equals(self, path, value, negate=False):
+        """The property at `path` must equal `value`."""
+        return self._add(_kRuleEquals, negate, path, value)
+
+    def isIn(self, path, values, negate=False):
+        """The property at `path` must equal one of `values`."""
+        return self._add(_kRuleIn, negate, path, list(values))
+
+    def exists(self, path, negate=False):
+        """There must be a property at `path`."""
+        return self._add(_kRuleExists, negate, path, None)
+
+    def deleted(self, isDeleted=True):
+        """The document must (or, if `isDeleted` is false, must not) be deleted."""
+        return self._add(_kRuleDeleted, False, None, isDeleted)
+
+    def callback(self, fn):
+        """Sets a Python function `fn(document, flags) -> bool` to call after the rules pass."""
+        self._callback = fn
+        self._compiled = None
+        return self
+
+    def _native(self, database, pythonCallback):
+        """Returns the compiled filter capsule. `pythonCallback` is the CFFI function to route
+           the Python callback through."""
+        if self._compiled is None or self._compiledFor is not database:
+            callbackAddr = contextAddr = 0
+            if self._callback is not None:
+                fn = self._callback
+                def wrapped(document, flags):
+                    ref = lib.CBL_Retain(document)
+                    doc = Document._fromAddress(database, sliceToString(lib.CBLDocument_ID(document)),
+                                                address(ref))
+                    return bool(fn(doc, flags))
+                handle = ffi.new_handle(wrapped)
+                self._handles.append(handle)    # an earlier compilation may still be in use
+                callbackAddr = address(pythonCallback)
+                contextAddr = address(handle)
+            self._compiled = native.newReplicationFilter(self.rules, self.passDeletions,
+                                                         callbackAddr, contextAddr)
+            self._compiledFor = database
+        return self._compiled
+
+    def matches(self, document, flags=0):
+        """Evaluates the filter on a Document, as a replicator would. Handy for testing rules."""
+        return native.replicationFilterMatches(self._native(document.database, lib.pushFilterCallback),
+                                               address(document._ref), flags)
 
 
 class ReplicatorConfiguration:
@@ -7,28 +128,40 @@ class ReplicatorConfiguration:
         self,
         database,
         url,
-        push_filter,
-        pull_filter,
-        conflict_resolver,
-        username,
-        password,
-        cert_path,
+        push_filter=None,
+        pull_filter=None,
+        conflict_resolver=ffi.NULL,
+        username=None,
+        password=None,
+        cert_path=None,
         max_attempt_wait_time=30,  # Default is 30 seconds
     ):
+        """`url` is the remote database's URL, or, in the Enterprise Edition, a local Database
+           to replicate with. `push_filter` and `pull_filter` may each be a ReplicationFilter,
+           a Python function `filter(document, flags) -> bool` (which is called on the
+           replicator's thread, holding the GIL), or None."""
         pinned_server_cert = []
         if cert_path:
             cert_as_bytes = open(cert_path, "rb").read()
             pinned_server_cert = [asSlice(cert_as_bytes)]
 
         self.database = database
-        self.endpoint = lib.CBLEndpoint_CreateWithURL(stringParam(url), gError)
-        self.replicator_type = 0
+        if isinstance(url, str):
+            self.endpoint = lib.CBLEndpoint_CreateWithURL(stringParam(url), threadError())
+        elif hasattr(lib, "CBLEndpoint_CreateWithLocalDB"):
+            self.endpoint = lib.CBLEndpoint_CreateWithLocalDB(url._ref)
+        else:
+            raise CBLException("Replicating with a local database requires the Enterprise Edition")
+        self.replicator_type = PushAndPull
         self.continuous = True
         self.disable_auto_purge = True
         self.max_attempts = 0
         self.max_attempt_wait_time = max_attempt_wait_time
         self.heartbeat = 0
-        self.authenticator = lib.CBLAuth_CreatePassword(stringParam(username), stringParam(password))
+        if username is None:
+            self.authenticator = ffi.NULL
+        else:
+            self.authenticator = lib.CBLAuth_CreatePassword(stringParam(username), stringParam(password))
         self.proxy = ffi.NULL
         self.headers = ffi.NULL
         self.pinned_server_cert = pinned_server_cert
@@ -40,7 +173,31 @@ class ReplicatorConfiguration:
         self.conflict_resolver = conflict_resolver
         self.context = ffi.NULL
 
+    def _filter(self, f):
+        if f is None or isinstance(f, ReplicationFilter):
+            return f
+        return ReplicationFilter(callback=f)
+
+    def _filters(self):
+        """Returns the push filter, pull filter and context to put in the CBL configuration.
+           Raw CFFI function pointers are passed through as they are; other filters are
+           compiled and combined natively, and kept alive by this configuration."""
+        push, pull = self.push_filter, self.pull_filter
+        if isinstance(push, ffi.CData) or isinstance(pull, ffi.CData):
+            return push, pull, self.context
+        push, pull = self._filter(push), self._filter(pull)
+        self._filterObjects = (push, pull)      # they own the handles of Python callbacks
+        if push is None and pull is None:
+            return ffi.NULL, ffi.NULL, self.context
+        pushCapsule = push._native(self.database, lib.pushFilterCallback) if push else None
+        pullCapsule = pull._native(self.database, lib.pullFilterCallback) if pull else None
+        self._filterPair, context, pushAddr, pullAddr = native.newReplicationFilterPair(pushCapsule, pullCapsule)
+        return (ffi.cast("CBLReplicationFilter", pushAddr),
+                ffi.cast("CBLReplicationFilter", pullAddr),
+                ffi.cast("void*", context))
+
     def _cblConfig(self):
+        push_filter, pull_filter, context = self._filters()
         return ffi.new("CBLReplicatorConfiguration*",
                        [self.database._ref,
                         self.endpoint,
@@ -57,23 +214,235 @@ class ReplicatorConfiguration:
                         self.truested_root_cert,
                         self.channels,
                         self.document_ids,
-                        self.push_filter,
-                        self.pull_filter,
+                        push_filter,
+                        pull_filter,
                         self.conflict_resolver,
-                        self.context])
+                        context])
+
+
+class ReplicatorStatus:
+    """A snapshot of a replicator's state. `complete` is a very approximate fraction from 0 to 1;
+       `error` is a CBLException, or None."""
+
+    def __init__(self, c_status):
+        self.activity = c_status.activity
+        self.complete = c_status.progress.complete
+        self.documentCount = c_status.progress.documentCount
+        self.error = None
+        if c_status.error.code != 0:
+            self.error = CBLException("Replication failed", ffi.new("CBLError*", c_status.error))
+
+    def __repr__(self):
+        return "ReplicatorStatus[%s, %.0f%%, %d docs]" % (ActivityNames[self.activity],
+                                                         100 * self.complete, self.documentCount)
+
+    @property
+    def activityName(self):
+        return ActivityNames[self.activity]
+
+
+class ReplicatedDocument (namedtuple("ReplicatedDocument",
+                                     "id isPush flags collection errorDomain errorCode")):
+    """One document that was pushed or pulled, or failed to be. `collection` is "scope.name"."""
+
+    __slots__ = ()
+
+    @property
+    def deleted(self):
+        return bool(self.flags & DocumentFlagsDeleted)
+
+    @property
+    def failed(self):
+        return self.errorCode != 0
 
 
 class Replicator (CBLObject):
+    # The most document-replication events queued for document listeners; more than that are
+    # dropped (but still counted in `metrics`) until the listeners catch up.
+    documentEventCapacity = 10000
+
+    # The most events passed to a document listener in one call.
+    documentEventBatch = 1000
+
     def __init__(self, config):
+        self.configuration = config     # keeps its filters alive as long as the replicator
         if config != None:
             config = config._cblConfig()
         CBLObject.__init__(self,
-                           lib.CBLReplicator_Create(config, gError),
-                           "Couldn't create replicator", gError)
+                           lib.CBLReplicator_Create(config, threadError()),
+                           "Couldn't create replicator", threadError())
         self.config = config
+        self.listeners = set()
+        self._lock = threading.Condition()
+        self._status = None
+        self._startedAt = self._idleAt = None
+        self._wasActive = False
+        self._baseCounts = {}
+        self._documentEvents = None
+        # Every document event is counted natively, without calling into Python:
+        self._eventQueue = native.newReplicationEventQueue(address(self._ref),
+                                                           self.documentEventCapacity)
+        # The status handle only has a weak reference, so it doesn't keep this object alive:
+        this = weakref.ref(self)
+        def statusChanged(status):
+            replicator = this()
+            if replicator is not None:
+                replicator._statusChanged(status)
+        self._statusHandle = ffi.new_handle(statusChanged)
+        self._statusToken = lib.CBLReplicator_AddChangeListener(
+            self._ref, lib.replicatorChangeListenerCallback, self._statusHandle
+        )
+
+    def __del__(self):
+        if "_statusToken" in self.__dict__:
+            lib.CBLListener_Remove(self._statusToken)
+        if self.__dict__.get("_documentEvents") is not None:
+            self._documentEvents.close()
+        self._eventQueue = None
+        CBLObject.__del__(self)
 
     def start(self, resetCheckpoint = False):
+        with self._lock:
+            self._startedAt = time.monotonic()
+            self._idleAt = None
+            self._wasActive = False
+            self._baseCounts = native.replicationEventCounts(self._eventQueue)[0]
         lib.CBLReplicator_Start(self._ref, resetCheckpoint)
 
     def stop(self):
         lib.CBLReplicator_Stop(self._ref)
+
+    @property
+    def status(self):
+        return ReplicatorStatus(lib.CBLReplicator_Status(self._ref))
+
+    def waitForIdle(self, timeout=None):
+        """Waits until the replicator has gone idle (or stopped) since `start` was called.
+           Returns false if it timed out."""
+        with self._lock:
+            return self._lock.wait_for(lambda: self._idleAt is not None, timeout)
+
+    # Listeners:
+
+    def addChangeListener(self, listener):
+        """Calls `listener(status)` with a ReplicatorStatus whenever the replicator's status
+           changes. It's called on the replicator's thread, so it should return quickly."""
+        self.listeners.add(listener)
+        return ListenerToken(self, listener, None)
+
+    def addDocumentListener(self, listener, dispatch=None):
+        """Calls `listener` with a list of ReplicatedDocuments after documents are pushed or
+           pulled. The events are queued natively, and delivered by a background thread in
+           batches of up to `documentEventBatch`; if the listeners fall more than
+           `documentEventCapacity` events behind, later ones are dropped. As with
+           `Database.addListener`, `dispatch(listener, documents)` is called instead if given."""
+        if self._documentEvents is None:
+            self._documentEvents = _DocumentEvents(self)
+        return self._documentEvents.addListener(listener, dispatch)
+
+    def _statusChanged(self, status):
+        with self._lock:
+            self._status = status
+            if status.activity in (Connecting, Busy):
+                self._wasActive = True
+            elif status.activity in (Idle, Stopped) and self._wasActive and self._idleAt is None:
+                self._idleAt = time.monotonic()
+            self._lock.notify_all()
+        for listener in list(self.listeners):
+            try:
+                listener(status)
+            except Exception:
+                traceback.print_exc()
+
+    # Metrics:
+
+    def metrics(self):
+        """Returns a dict of metrics about the replication since `start` was last called:
+           the numbers of documents pushed, pulled and failed, the failures per collection,
+           docs/sec (until it went idle, if it has), the time in seconds it took to go idle
+           (or None), and the number of events dropped by the document-listener queue."""
+        counts, dropped = native.replicationEventCounts(self._eventQueue)
+        with self._lock:
+            startedAt, idleAt, status, base = self._startedAt, self._idleAt, self._status, self._baseCounts
+        pushed = pulled = errors = 0
+        errorsByCollection = {}
+        for name, (p, q, e) in counts.items():
+            bp, bq, be = base.get(name, (0, 0, 0))
+            pushed += p - bp
+            pulled += q - bq
+            errors += e - be
+            if e > be:
+                errorsByCollection[name] = e - be
+        elapsed = 0.0
+        if startedAt is not None:
+            elapsed = (idleAt if idleAt is not None else time.monotonic()) - startedAt
+        return {"activity": status.activityName if status else "stopped",
+                "progress": status.complete if status else 0.0,
+                "pushed": pushed,
+                "pulled": pulled,
+                "errors": errors,
+                "errorsByCollection": errorsByCollection,
+                "docsPerSecond": (pushed + pulled) / elapsed if elapsed > 0 else 0.0,
+                "timeToIdle": idleAt - startedAt if idleAt is not None else None,
+                "droppedEvents": dropped}
+
+
+class _DocumentEvents:
+    """A replicator's document-listener queue. A background thread waits for the native queue
+       to collect events, and calls the listeners with them."""
+
+    def __init__(self, replicator):
+        self.listeners = set()
+        self._queue = replicator._eventQueue
+        self._batch = replicator.documentEventBatch
+        self._stopped = False
+        native.keepReplicationEvents(self._queue, True)
+        self._thread = threading.Thread(target=self._run, name="CBL replication events", daemon=True)
+        self._thread.start()
+
+    def addListener(self, listener, dispatch):
+        if dispatch is None:
+            deliver = listener
+        else:
+            deliver = lambda documents: dispatch(listener, documents)
+        self.listeners.add(deliver)
+        return ListenerToken(self, deliver, None)
+
+    def _run(self):
+        while not self._stopped:
+            events = native.waitForReplicationEvents(self._queue, -1, self._batch)
+            if self._stopped:
+                break
+            if events:
+                documents = [ReplicatedDocument(*event) for event in events]
+                for deliver in list(self.listeners):
+                    try:
+                        deliver(documents)
+                    except Exception:
+                        traceback.print_exc()
+
+    def close(self):
+        self._stopped = True
+        native.keepReplicationEvents(self._queue, False)
+        native.wakeReplicationEventQueue(self._queue)
+        if threading.current_thread() is not self._thread:
+            self._thread.join()
+        self.listeners.clear()
+
+
+# Python filter functions are called through these, from a native ReplicationFilter whose
+# rules the document passed; `context` is a handle to the wrapped function.
+
+@ffi.def_extern()
+def pushFilterCallback(context, document, flags):
+    return ffi.from_handle(context)(document, flags)
+
+
+@ffi.def_extern()
+def pullFilterCallback(context, document, flags):
+    return ffi.from_handle(context)(document, flags)
+
+
+@ffi.def_extern()
+def replicatorChangeListenerCallback(context, replicator, status):
+    ffi.from_handle(context)(ReplicatorStatus(status))
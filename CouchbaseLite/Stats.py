@@ -0,0 +1,104 @@
+# Stats.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import threading
+from time import perf_counter
+
+
+class Histogram:
+    """A latency histogram with power-of-two buckets: bucket `i` counts the samples of less than
+       2^i microseconds (and at least 2^(i-1).) Recording one is a few arithmetic operations."""
+
+    kBuckets = 32       # the last one also holds anything over ~35 minutes
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.count = 0
+        self.total = 0.0
+        self.max = 0.0
+        self.buckets = [0] * Histogram.kBuckets
+
+    def record(self, seconds):
+        self.count += 1
+        self.total += seconds
+        if seconds > self.max:
+            self.max = seconds
+        self.buckets[min(int(seconds * 1e6).bit_length(), Histogram.kBuckets - 1)] += 1
+
+    def percentile(self, p):
+        """Returns the upper bound, in seconds, of the bucket holding the `p`th percentile."""
+        if self.count == 0:
+            return 0.0
+        target = p / 100.0 * self.count
+        seen = 0
+        for i, n in enumerate(self.buckets):
+            seen += n
+            if seen >= target:
+                return min((1 << i) / 1e6, self.max)
+        return self.max
+
+    def snapshot(self):
+        return {"count": self.count,
+                "total": self.total,
+                "mean": self.total / self.count if self.count else 0.0,
+                "p50": self.percentile(50),
+                "p90": self.percentile(90),
+                "p99": self.percentile(99),
+                "max": self.max,
+                "buckets": list(self.buckets)}
+
+
+class Stats:
+    """Operation counters and latency histograms for one Database. Enable them with
+       `Database.enableStats()`; while they're disabled, each instrumented call only pays for
+       checking that `database._stats` is None.
+
+       Timings (seconds) are named like "document.get" or "query.execute"; counters like
+       "fleece.decode.bytes" or "listener.callbacks"."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self.counters = {}
+        self.histograms = {}
+
+    def count(self, name, n=1):
+        with self._lock:
+            self.counters[name] = self.counters.get(name, 0) + n
+
+    def timing(self, name, seconds):
+        with self._lock:
+            histogram = self.histograms.get(name)
+            if histogram is None:
+                histogram = self.histograms[name] = Histogram()
+            histogram.record(seconds)
+
+    def since(self, name, start):
+        """Records the time elapsed since `start`, a `perf_counter()` value."""
+        self.timing(name, perf_counter() - start)
+
+    def snapshot(self):
+        """Returns a copy of the current values, as plain dicts suitable for JSON."""
+        with self._lock:
+            return {"counters": dict(self.counters),
+                    "latency": {name: h.snapshot() for name, h in self.histograms.items()}}
+
+    def reset(self):
+        with self._lock:
+            self.counters.clear()
+            self.histograms.clear()
@@ -0,0 +1,234 @@
+# WriteBehind.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import threading
+import time
+from collections import OrderedDict
+from concurrent.futures import Future
+from time import perf_counter
+
+from .common import *
+from .Document import Document, LastWriteWins
+
+# Stands for a pending delete in place of a document's properties:
+_kDelete = object()
+
+
+class WriteBehindQueue:
+    """Saves documents asynchronously, in group commits. Create one with
+       `Database.enableWriteBehind`.
+
+       `put` and `delete` return right away with a `concurrent.futures.Future`, which completes
+       once the change is committed (or fails with its CBLException.) Use
+       `asyncio.wrap_future` to await one. Pending changes to the same document are coalesced:
+       the latest properties replace the pending ones, or if `merge` is given, the pending
+       properties become `merge(pending, new)`. A document is written only once per commit,
+       and all the futures for it complete together.
+
+       A background thread commits everything pending in one transaction, as soon as
+       `maxBatch` documents are pending or the oldest change has waited `maxLatency` seconds.
+       If `maxPending` documents are waiting, `put` and `delete` block until the next commit.
+
+       A future can be cancelled until its commit starts. A pending change is dropped if all of
+       its futures were cancelled; if only some were, the coalesced change is still written.
+
+       Properties are encoded when they're committed, not when they're queued, so don't
+       modify a dict after passing it to `put`.
+
+       The commits go through `writer`, a Database handle the queue closes when it's closed.
+       `Database.enableWriteBehind` opens a separate handle on the same file for this, since a
+       transaction belongs to a handle, not a thread: committing through `database` itself
+       would make writes that other threads make on it meanwhile part of (or aborted with) the
+       queue's transaction. If `writer` is None, `database` is used anyway, with that caveat."""
+
+    def __init__(self, database, maxBatch=1000, maxLatency=0.05, maxPending=100000,
+                 merge=None, concurrency=LastWriteWins, writer=None):
+        self.database = database
+        self.writer = writer if writer is not None else database
+        self.maxBatch = maxBatch
+        self.maxLatency = maxLatency
+        self.maxPending = maxPending
+        self.merge = merge
+        self.concurrency = concurrency
+        self.puts = self.coalesced = self.commits = self.written = self.failed = 0
+        self._pending = OrderedDict()   # docID -> [properties or _kDelete, [Future]]
+        self._oldest = None             # monotonic time the oldest pending change was queued
+        self._queued = 0                # number of changes queued so far
+        self._committed = 0             # value of `_queued` as of the last finished commit
+        self._flushRequested = False
+        self._stopping = False
+        self._cond = threading.Condition()
+        self._thread = threading.Thread(target=self._run, daemon=True,
+                                        name="CBL write-behind: " + database.name)
+        self._thread.start()
+
+    def __repr__(self):
+        return "WriteBehindQueue[%s, %d pending]" % (self.database.name, len(self._pending))
+
+    def __len__(self):
+        return len(self._pending)
+
+    def put(self, docID, properties):
+        """Queues a save of a document's properties (a dict), and returns a Future."""
+        return self._enqueue(docID, properties)
+
+    def delete(self, docID):
+        """Queues a deletion of a document, and returns a Future."""
+        return self._enqueue(docID, _kDelete)
+
+    def _enqueue(self, docID, properties):
+        future = Future()
+        with self._cond:
+            if self._stopping:
+                raise CBLException("WriteBehindQueue is closed")
+            if threading.current_thread() is not self._thread:
+                while len(self._pending) >= self.maxPending and docID not in self._pending:
+                    self._cond.wait()
+                    if self._stopping:
+                        raise CBLException("WriteBehindQueue is closed")
+            entry = self._pending.get(docID)
+            if entry is None:
+                self._pending[docID] = [properties, [future]]
+                if self._oldest is None:
+                    self._oldest = time.monotonic()
+                    self._cond.notify_all()
+            else:
+                pending = entry[0]
+                if self.merge is not None and properties is not _kDelete and pending is not _kDelete:
+                    properties = self.merge(pending, properties)
+                entry[0] = properties
+                entry[1].append(future)
+                self.coalesced += 1
+            self.puts += 1
+            self._queued += 1
+            if len(self._pending) == self.maxBatch:
+                self._cond.notify_all()
+        return future
+
+    def flush(self, timeout=None):
+        """Commits everything queued so far, without waiting for `maxLatency`, and waits for
+           the commit to finish. Returns false if it timed out."""
+        with self._cond:
+            target = self._queued
+            self._flushRequested = True
+            self._cond.notify_all()
+            return self._cond.wait_for(lambda: self._committed >= target or not self._thread.is_alive(),
+                                       timeout)
+
+    def stats(self):
+        """Returns the numbers of changes queued, changes coalesced into a pending one, commits,
+           and documents written or failed, and the average documents per commit."""
+        with self._cond:
+            return {"pending": len(self._pending), "puts": self.puts, "coalesced": self.coalesced,
+                    "commits": self.commits, "written": self.written, "failed": self.failed,
+                    "docsPerCommit": self.written / self.commits if self.commits else 0.0}
+
+    def close(self):
+        """Commits whatever's pending and stops the background thread. `Database.close` calls
+           this."""
+        with self._cond:
+            self._stopping = True
+            self._cond.notify_all()
+        if threading.current_thread() is not self._thread:
+            self._thread.join()
+        if self.writer is not self.database:
+            self.writer.close()
+
+    # Background thread:
+
+    def _nextBatch(self):
+        with self._cond:
+            while True:
+                if self._pending:
+                    if self._stopping or self._flushRequested or len(self._pending) >= self.maxBatch:
+                        break
+                    delay = self._oldest + self.maxLatency - time.monotonic()
+                    if delay <= 0:
+                        break
+                    self._cond.wait(delay)
+                elif self._stopping:
+                    return None, None
+                else:
+                    self._flushRequested = False
+                    self._cond.wait()
+            batch, self._pending = self._pending, OrderedDict()
+            self._oldest = None
+            self._flushRequested = False
+            self._cond.notify_all()     # wakes up callers blocked by `maxPending`
+            queued = self._queued
+        # From here on the futures can't be cancelled; drop the ones that already were, and the
+        # changes nobody's waiting for anymore
+        for entry in batch.values():
+            entry[1] = [future for future in entry[1] if future.set_running_or_notify_cancel()]
+        return OrderedDict((docID, entry) for docID, entry in batch.items() if entry[1]), queued
+
+    def _run(self):
+        while True:
+            batch, queued = self._nextBatch()
+            if batch is None:
+                break
+            failures = {}
+            if batch:       # (else every change in it was cancelled)
+                try:
+                    failures = self._commit(batch)
+                except Exception as x:
+                    failures = {docID: x for docID in batch}
+            for docID, (properties, futures) in batch.items():
+                exception = failures.get(docID)
+                for future in futures:
+                    if exception is None:
+                        future.set_result(None)
+                    else:
+                        future.set_exception(exception)
+            with self._cond:
+                if batch:
+                    self.commits += 1
+                self.written += len(batch) - len(failures)
+                self.failed += len(failures)
+                self._committed = queued
+                self._cond.notify_all()
+
+    def _commit(self, batch):
+        """Writes a batch in one transaction; returns a dict of the docIDs that failed to save,
+           mapped to their exceptions."""
+        db = self.writer
+        saves = [(docID, entry[0]) for docID, entry in batch.items() if entry[0] is not _kDelete]
+        deletes = [docID for docID, entry in batch.items() if entry[0] is _kDelete]
+        failures = {}
+        stats = self.database._stats
+        if stats is not None:
+            start = perf_counter()
+        with db:
+            if saves:
+                for (docID, properties), exception in db.saveDocuments(saves, len(saves), self.concurrency):
+                    failures[docID] = exception
+            for docID in deletes:
+                try:
+                    if Document._get(db, docID) is not None:     # else it's already gone
+                        db.deleteDocument(docID)
+                except Exception as x:
+                    failures[docID] = x
+        if db is not self.database:
+            # The writer handle's counters and cache aren't the ones anyone looks at
+            failedDeletes = sum(1 for docID in deletes if docID in failures)
+            self.database._writeCount += len(saves) - (len(failures) - failedDeletes)
+            self.database._deleteCount += len(deletes) - failedDeletes
+            self.database._invalidateCached(batch.keys())
+        if stats is not None:
+            stats.since("writeBehind.commit", start)
+            stats.count("writeBehind.docs", len(batch))
+        return failures
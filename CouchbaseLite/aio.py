@@ -0,0 +1,276 @@
+# aio.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""An asyncio front-end to Database, Query, Blob and Replicator.
+
+   Each AsyncDatabase owns a dedicated single-thread executor, and every call that reaches
+   Couchbase Lite runs there, so the event loop never blocks on it. CFFI releases the GIL for
+   the duration of each C call, so the worker holds no Python locks while CBL is busy. Using
+   one thread per database also keeps its calls in order, and keeps the Database's Python
+   state (such as its query cache) single-threaded.
+
+   Listeners are called on the event loop, via `loop.call_soon_threadsafe`."""
+
+import asyncio
+from concurrent.futures import ThreadPoolExecutor
+
+from .Database import Database
+from .Document import FailOnConflict
+from .Blob import Blob
+
+
+def onLoop(listener, loop=None):
+    """Wraps a listener so that, whatever thread it's called on, it runs on the event loop."""
+    loop = loop or asyncio.get_running_loop()
+    return lambda *args: loop.call_soon_threadsafe(listener, *args)
+
+
+class AsyncDatabase:
+    def __init__(self, database, executor=None):
+        """Wraps an open Database. If `executor` isn't given, a single-thread executor is
+           created, and shut down by `close`."""
+        self.database = database
+        self._ownsExecutor = executor is None
+        self.executor = executor or ThreadPoolExecutor(1, thread_name_prefix="CBL " + database.name)
+
+    @staticmethod
+    async def open(name, config=None):
+        executor = ThreadPoolExecutor(1, thread_name_prefix="CBL " + name)
+        db = await asyncio.get_running_loop().run_in_executor(executor, Database, name, config)
+        adb = AsyncDatabase(db, executor)
+        adb._ownsExecutor = True
+        return adb
+
+    def __repr__(self):
+        return "AsyncDatabase['" + self.database.name + "']"
+
+    def _run(self, fn, *args):
+        return asyncio.get_running_loop().run_in_executor(self.executor, fn, *args)
+
+    async def close(self):
+        await self._run(self.database.close)
+        if self._ownsExecutor:
+            self.executor.shutdown(wait=False)
+
+    @property
+    def name(self):
+        return self.database.name
+
+    async def count(self):
+        return await self._run(lambda: self.database.count)
+
+    # Documents:
+
+    async def getDocument(self, id):
+        """Returns the Document, with its properties already decoded, or None."""
+        def get():
+            doc = self.database.getDocument(id)
+            if doc is not None:
+                doc.properties      # decode on the worker thread, not the loop
+            return doc
+        return await self._run(get)
+
+    async def getMutableDocument(self, id):
+        def get():
+            doc = self.database.getMutableDocument(id)
+            if doc is not None:
+                doc.properties
+            return doc
+        return await self._run(get)
+
+    async def getDocuments(self, ids, decode=True, snapshot=False):
+        return await self._run(self.database.getDocuments, ids, decode, snapshot)
+
+    async def save(self, doc, concurrency=FailOnConflict):
+        """Saves a MutableDocument."""
+        await self._run(self.database.saveDocument, doc, concurrency)
+
+    saveDocument = save
+
+    async def saveDocuments(self, docs, chunkSize=1000, concurrency=FailOnConflict):
+        """Like `Database.saveDocuments`. `docs` is consumed on the worker thread, so don't
+           pass a generator that touches loop state."""
+        return await self._run(self.database.saveDocuments, docs, chunkSize, concurrency)
+
+    async def deleteDocument(self, id):
+        await self._run(self.database.deleteDocument, id)
+
+    async def purgeDocument(self, id):
+        await self._run(self.database.purgeDocument, id)
+
+    async def importNDJSON(self, file, idField=None, chunkSize=1000):
+        return await self._run(self.database.importNDJSON, file, idField, chunkSize)
+
+    async def exportNDJSON(self, file, query=None, idField="_id"):
+        return await self._run(self.database.exportNDJSON, file, query, idField)
+
+    # Queries:
+
+    def query(self, queryString, language=None):
+        """Returns an AsyncQuery. Compiling it is deferred to the first execution."""
+        return AsyncQuery(self, queryString, language)
+
+    # Listeners:
+
+    def addListener(self, listener):
+        """Calls `listener(docIDs)` on the event loop after documents change. The database is
+           put in buffered-notification mode, so a burst of changes arrives as one batch."""
+        return self.database.addListener(listener, buffered=True,
+                                         dispatch=asyncio.get_running_loop().call_soon_threadsafe)
+
+    def addDocumentListener(self, docID, listener):
+        return self.database.addDocumentListener(docID, onLoop(listener))
+
+
+class AsyncQuery:
+    def __init__(self, adb, queryString, language=None):
+        self.adb = adb
+        self.queryString = queryString
+        self.language = language
+        self._query = None
+
+    def __repr__(self):
+        return "AsyncQuery['" + str(self.queryString) + "']"
+
+    def _compiled(self):
+        if self._query is None:
+            if self.language is None:
+                self._query = self.adb.database.query(self.queryString)
+            else:
+                self._query = self.adb.database.query(self.queryString, self.language)
+        return self._query
+
+    async def setParameters(self, params):
+        await self.adb._run(lambda: self._compiled().setParameters(params))
+
+    async def columnNames(self):
+        return await self.adb._run(lambda: self._compiled().columnNames)
+
+    async def execute(self, batchSize=1000):
+        """Executes the query, yielding each row as a dict. The rows are fetched and decoded
+           `batchSize` at a time on the worker thread."""
+        rows = await self.adb._run(lambda: self._compiled().execute())
+        def nextBatch():
+            batch = []
+            for row in rows:
+                batch.append(row.asDictionary())
+                if len(batch) == batchSize:
+                    break
+            return batch
+        try:
+            while True:
+                batch = await self.adb._run(nextBatch)
+                for row in batch:
+                    yield row
+                if len(batch) < batchSize:
+                    break
+        finally:
+            await self.adb._run(rows.close)    # releases the result set on the worker thread
+
+    async def executeColumnar(self):
+        return await self.adb._run(lambda: self._compiled().executeColumnar())
+
+    async def explanation(self):
+        return await self.adb._run(lambda: self._compiled().explanation)
+
+    async def addListener(self, listener):
+        query = await self.adb._run(self._compiled)
+        return query.addListener(onLoop(listener))
+
+    async def addResultsListener(self, listener, key=0):
+        """Like `Query.addResultsListener`; the listener is called on the event loop."""
+        query = await self.adb._run(self._compiled)
+        return query.addResultsListener(listener, key, asyncio.get_running_loop().call_soon_threadsafe)
+
+
+class AsyncBlob:
+    """Reads a Blob's content through a BlobReader on the database's worker thread."""
+
+    def __init__(self, adb, blob):
+        self.adb = adb
+        self.blob = blob
+        self._reader = None
+
+    def __repr__(self):
+        return "Async" + repr(self.blob)
+
+    @staticmethod
+    async def fromFile(adb, path, contentType=None):
+        blob = await adb._run(Blob.fromFile, adb.database, path, contentType)
+        return AsyncBlob(adb, blob)
+
+    @property
+    def length(self):
+        return self.blob.length
+
+    @property
+    def contentType(self):
+        return self.blob.contentType
+
+    async def content(self):
+        return await self.adb._run(lambda: self.blob.content)
+
+    async def read(self, n=-1):
+        """Reads up to `n` bytes (all remaining ones if `n` is negative) from the current
+           position; returns an empty bytes object at the end."""
+        def read():
+            if self._reader is None:
+                self._reader = self.blob.openStream()
+            return self._reader.read(n)
+        return await self.adb._run(read)
+
+    async def seek(self, offset):
+        def seek():
+            if self._reader is None:
+                self._reader = self.blob.openStream()
+            return self._reader.seek(offset)
+        return await self.adb._run(seek)
+
+    async def close(self):
+        if self._reader is not None:
+            await self.adb._run(self._reader.close)
+            self._reader = None
+
+
+class AsyncReplicator:
+    """Starts and stops a Replicator on the database's worker thread, and calls its listeners
+       on the event loop."""
+
+    def __init__(self, adb, replicator):
+        self.adb = adb
+        self.replicator = replicator
+
+    async def start(self, resetCheckpoint=False):
+        await self.adb._run(self.replicator.start, resetCheckpoint)
+
+    async def stop(self):
+        await self.adb._run(self.replicator.stop)
+
+    async def waitForIdle(self, timeout=None):
+        # Waits in the loop's default executor, so the database's worker stays free meanwhile
+        return await asyncio.get_running_loop().run_in_executor(None, self.replicator.waitForIdle, timeout)
+
+    def metrics(self):
+        return self.replicator.metrics()
+
+    def addChangeListener(self, listener):
+        return self.replicator.addChangeListener(onLoop(listener))
+
+    def addDocumentListener(self, listener):
+        """Calls `listener` on the event loop with batches of ReplicatedDocuments."""
+        return self.replicator.addDocumentListener(listener,
+                                                   dispatch=asyncio.get_running_loop().call_soon_threadsafe)
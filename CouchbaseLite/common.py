@@ -16,6 +16,7 @@
 #
 
 from ._PyCBL import ffi, lib
+import threading
 
 def cstr(str):
     return ffi.new("char[]", str.encode("utf-8"))
@@ -36,13 +37,21 @@ def sliceResultToString(sr):
     return str
 
 def sliceResultToBytes(sr):
-    """Copies a FLSliceResult to a Python bytes object. Does not free the FLSliceResult."""
+    """Copies a FLSliceResult to a Python bytes object and frees it."""
     if sr.buf == None:
         return None
-    lib.FLSliceResult_Release(sr)
     b = bytes( ffi.buffer(sr.buf, sr.size) )
+    lib.FLSliceResult_Release(sr)
     return b
 
+def sliceResultToMemoryView(sr):
+    """Returns a read-only memoryview of a FLSliceResult's bytes, without copying them. The
+       FLSliceResult is freed when the memoryview, and anything still using its memory, is gone."""
+    if sr.buf == None:
+        return None
+    owner = ffi.gc(ffi.cast("char*", sr.buf), lambda buf: lib.FLSliceResult_Release(sr))
+    return memoryview(ffi.buffer(owner, sr.size)).toreadonly()
+
 def asSlice(data):
     """Returns a FLSlice pointing to the data."""
     buffer = ffi.from_buffer(data)
@@ -51,6 +60,10 @@ def asSlice(data):
     s.size = len(buffer)
     return s
 
+def address(ptr):
+    """Returns a C pointer's address as a Python int, for passing to the `_PyCBLNative` module."""
+    return int(ffi.cast("uintptr_t", ptr))
+
 def stringParam(str):
     """Returns a pointer/length array suitable for passing to an FLSlice C function parameter."""
     if str is None:
@@ -59,9 +72,28 @@ def stringParam(str):
     buffer = ffi.from_buffer(utf8)
     return [buffer, len(buffer)]
 
-# A global CBLError object to use in API calls, so each call doesn't have to
-# allocate a new one. (This is fine as long as we're single-threaded.)
-gError = ffi.new("CBLError*")
+# Each thread has its own CBLError object to use in API calls, so each call doesn't have to
+# allocate a new one, and a failure on one thread can't clobber the error reported on another.
+_threadState = threading.local()
+
+def threadError():
+    """Returns the calling thread's CBLError object, for passing to API calls."""
+    try:
+        return _threadState.error
+    except AttributeError:
+        _threadState.error = ffi.new("CBLError*")
+        return _threadState.error
+
+# The CBLError domain and code for something that doesn't exist (CBLDomain, CBLErrorNotFound):
+CBLDomain = 1
+CBLErrorNotFound = 7
+
+def notFoundError():
+    """Returns a new CBLError saying something wasn't found, for CBLException."""
+    error = ffi.new("CBLError*")
+    error.domain = CBLDomain
+    error.code = CBLErrorNotFound
+    return error
 
 
 class CBLException (EnvironmentError):
@@ -97,7 +129,8 @@ class ListenerToken (object):
 
     def remove(self):
         if self.owner != None:
-            lib.CBLListener_Remove(self.c_token)
-            self.owner.listeners.remove(self.handle)
+            if self.c_token != None:    # buffered listeners have no CBL token of their own
+                lib.CBLListener_Remove(self.c_token)
+            self.owner.listeners.discard(self.handle)
             self.owner = None
             self.handle = None
@@ -0,0 +1,105 @@
+#! /usr/bin/env python3
+#
+#  aio.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures event-loop stalls while several tasks save documents and run queries concurrently:
+# once calling Database and Query directly from coroutines, and once through CouchbaseLite.aio.
+# A heartbeat task asks to wake every millisecond and records how late it actually wakes.
+
+import argparse
+import asyncio
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Document import MutableDocument
+from CouchbaseLite.aio import AsyncDatabase
+
+kQuery = "SELECT meta().id, n FROM _ WHERE n >= $n ORDER BY n LIMIT 500"
+
+
+async def heartbeat(lateness, done):
+    while not done.is_set():
+        start = time.perf_counter()
+        await asyncio.sleep(0.001)
+        lateness.append(time.perf_counter() - start - 0.001)
+
+
+async def blockingWorker(db, worker, ops):
+    query = db.query(kQuery)
+    for i in range(ops):
+        doc = MutableDocument("w%d-%d" % (worker, i))
+        doc["n"] = i
+        db.saveDocument(doc)
+        query.setParameters({"n": i})
+        rows = [row.asDictionary() for row in query.execute()]
+        await asyncio.sleep(0)
+
+
+async def asyncWorker(adb, worker, ops):
+    query = adb.query(kQuery)
+    for i in range(ops):
+        doc = MutableDocument("w%d-%d" % (worker, i))
+        doc["n"] = i
+        await adb.save(doc)
+        await query.setParameters({"n": i})
+        rows = [row async for row in query.execute()]
+
+
+async def run(workers, ops, makeWorker):
+    lateness = []
+    done = asyncio.Event()
+    beat = asyncio.create_task(heartbeat(lateness, done))
+    start = time.perf_counter()
+    await asyncio.gather(*(makeWorker(w) for w in range(workers)))
+    elapsed = time.perf_counter() - start
+    done.set()
+    await beat
+    lateness.sort()
+    return (workers * ops / elapsed,
+            1000 * lateness[len(lateness) * 99 // 100],
+            1000 * lateness[-1],
+            len(lateness) / elapsed)
+
+
+async def main(args):
+    results = []
+    for name in ("blocking", "aio"):
+        Database.deleteFile("bench_aio", args.dir)
+        db = Database("bench_aio", DatabaseConfiguration(args.dir))
+        if name == "blocking":
+            result = await run(args.workers, args.ops, lambda w: blockingWorker(db, w, args.ops))
+        else:
+            adb = AsyncDatabase(db)
+            result = await run(args.workers, args.ops, lambda w: asyncWorker(adb, w, args.ops))
+            adb.executor.shutdown()
+        results.append((name, result))
+        db.close()
+        Database.deleteFile("bench_aio", args.dir)
+
+    print("%d workers x %d saves+queries" % (args.workers, args.ops))
+    print("%-10s %10s %14s %14s %12s" % ("", "ops/s", "p99 stall ms", "max stall ms", "beats/s"))
+    for name, (opsPerSec, p99, worst, beats) in results:
+        print("%-10s %10.0f %14.2f %14.2f %12.0f" % (name, opsPerSec, p99, worst, beats))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="asyncio event-loop latency benchmark")
+    parser.add_argument('--workers', type=int, default=8, help="number of concurrent tasks")
+    parser.add_argument('--ops', type=int, default=2000, help="saves+queries per task")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    asyncio.run(main(parser.parse_args()))
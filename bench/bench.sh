@@ -0,0 +1,10 @@
+#! /bin/bash -e
+#
+# Convenience script to run one of the benchmarks in this directory, e.g. `bench/bench.sh decode.py` --
+# just sets PYTHONPATH to point to the parent dir, so the CouchbaseLite package will be loaded.
+
+SCRIPT_DIR=`dirname $0`
+cd "$SCRIPT_DIR"
+
+export PYTHONPATH=..
+python3 "$@"
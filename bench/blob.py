@@ -0,0 +1,86 @@
+#! /usr/bin/env python3
+#
+#  blob.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures blob import and export throughput in MB/s: `Blob.fromFile` and reading back
+# through a BlobReader stream, versus reading the whole file into memory for `Blob(data)`
+# and reading back with `Blob.data`. Also reports the growth in peak memory use of each.
+
+import argparse
+import os
+import resource
+import shutil
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Blob import Blob
+
+kMB = 1024 * 1024
+
+
+def peakMB():
+    # ru_maxrss is in KB on Linux, bytes on macOS
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return rss / (kMB if os.uname().sysname == "Darwin" else 1024)
+
+
+def measure(fn, size):
+    peak = peakMB()
+    start = time.perf_counter()
+    fn()
+    return size / kMB / (time.perf_counter() - start), peakMB() - peak
+
+
+def streamOut(blob):
+    with blob.openStream() as reader, open(os.devnull, "wb") as out:
+        shutil.copyfileobj(reader, out, Blob.kFileChunkSize)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Blob streaming benchmark")
+    parser.add_argument('--mb', type=int, default=500, help="size of the blob in MB")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database and file in")
+    args = parser.parse_args()
+
+    path = os.path.join(args.dir, "bench_blob.bin")
+    size = args.mb * kMB
+    with open(path, "wb") as f:
+        for i in range(args.mb):
+            f.write(os.urandom(kMB))
+
+    Database.deleteFile("bench_blob", args.dir)
+    db = Database("bench_blob", DatabaseConfiguration(args.dir))
+
+    # Streaming goes first, since peak memory use can only go up.
+    blobs = []
+    results = [("Blob.fromFile",    measure(lambda: blobs.append(Blob.fromFile(db, path)), size)),
+               ("BlobReader",       measure(lambda: streamOut(blobs[0]), size))]
+    def importInMemory():
+        with open(path, "rb") as f:
+            blobs.append(Blob(f.read()))
+    results += [("Blob(data)",      measure(importInMemory, size)),
+                ("Blob.data",       measure(lambda: blobs[0].data, size))]
+
+    print("%d MB blob" % args.mb)
+    print("%-16s %10s %14s" % ("", "MB/s", "peak mem +MB"))
+    for name, (mbps, mem) in results:
+        print("%-16s %10.0f %14.0f" % (name, mbps, mem))
+
+    db.close()
+    Database.deleteFile("bench_blob", args.dir)
+    os.remove(path)
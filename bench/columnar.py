@@ -0,0 +1,74 @@
+#! /usr/bin/env python3
+#
+#  columnar.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures rows/sec read from a query by iterating `Query.execute` row by row,
+# versus `Query.executeColumnar`.
+
+import argparse
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Query import N1QLQuery
+
+kQuery = "SELECT id, price, qty, inStock, name FROM _"
+
+
+def populate(db, count):
+    entries = (("row-%07d" % i,
+                {"id": i, "price": i * 0.25, "qty": i % 100, "inStock": (i % 3 != 0), "name": "item %d" % i})
+               for i in range(count))
+    assert db.saveDocuments(entries, chunkSize=10000) == []
+
+
+def benchRows(query, count):
+    start = time.perf_counter()
+    columns = [[] for name in query.columnNames]
+    for row in query.execute():
+        for i, col in enumerate(columns):
+            col.append(row[i])
+    assert len(columns[0]) == count
+    return count / (time.perf_counter() - start)
+
+
+def benchColumnar(query, count):
+    start = time.perf_counter()
+    columns = query.executeColumnar()
+    assert len(columns["id"]) == count
+    return count / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Columnar query benchmark")
+    parser.add_argument('--rows', type=int, default=1000000, help="number of rows")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_columnar", args.dir)
+    db = Database("bench_columnar", DatabaseConfiguration(args.dir))
+    populate(db, args.rows)
+    query = N1QLQuery(db, kQuery)
+
+    rows = benchRows(query, args.rows)
+    columnar = benchColumnar(query, args.rows)
+    print("%d rows, %d columns" % (args.rows, query.columnCount))
+    print("%-24s %14.0f rows/s" % ("Query.execute", rows))
+    print("%-24s %14.0f rows/s  (%.1fx)" % ("Query.executeColumnar", columnar, columnar / rows))
+
+    db.close()
+    Database.deleteFile("bench_columnar", args.dir)
@@ -0,0 +1,88 @@
+#! /usr/bin/env python3
+#
+#  decode.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures documents/sec decoded by `Document.getProperties` and `QueryResult.asDictionary`,
+# with the pure-Python Fleece decoder ("before") and the native one ("after").
+
+import argparse
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Document import MutableDocument
+from CouchbaseLite.Query import N1QLQuery
+import CouchbaseLite.Collections as Collections
+
+
+def makeProperties(i, width):
+    props = {"type": "bench", "index": i, "ratio": i / 7.0, "flag": (i % 2 == 0), "missing": None}
+    for f in range(width):
+        props["field%d" % f] = "value %d of doc %d" % (f, i)
+    props["nested"] = {"tags": ["red", "green", "blue"], "point": {"x": i, "y": -i}}
+    return props
+
+
+def populate(db, count, width):
+    with db:
+        for i in range(count):
+            doc = MutableDocument("doc-%06d" % i)
+            doc.properties = makeProperties(i, width)
+            db.saveDocument(doc)
+
+
+def benchGetProperties(db, count):
+    start = time.perf_counter()
+    for i in range(count):
+        db.getDocument("doc-%06d" % i).properties
+    return count / (time.perf_counter() - start)
+
+
+def benchAsDictionary(db, count):
+    query = N1QLQuery(db, "SELECT * FROM _")
+    start = time.perf_counter()
+    rows = 0
+    for row in query.execute():
+        row.asDictionary()
+        rows += 1
+    assert rows == count
+    return rows / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Fleece decoding benchmark")
+    parser.add_argument('--docs', type=int, default=10000, help="number of documents")
+    parser.add_argument('--width', type=int, default=200, help="number of top-level string fields per doc")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_decode", args.dir)
+    db = Database("bench_decode", DatabaseConfiguration(args.dir))
+    populate(db, args.docs, args.width)
+
+    print("%d docs, %d fields each" % (args.docs, args.width + 6))
+    print("%-28s %14s %14s %9s" % ("", "Python docs/s", "native docs/s", "speedup"))
+    for name, fn in [("Document.getProperties", benchGetProperties),
+                     ("QueryResult.asDictionary", benchAsDictionary)]:
+        Collections.useNativeDecoder = False
+        before = fn(db, args.docs)
+        Collections.useNativeDecoder = True
+        after = fn(db, args.docs)
+        print("%-28s %14.0f %14.0f %8.1fx" % (name, before, after, after / before))
+
+    db.close()
+    Database.deleteFile("bench_decode", args.dir)
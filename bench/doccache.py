@@ -0,0 +1,72 @@
+#! /usr/bin/env python3
+#
+#  doccache.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures reads/sec of a small set of hot documents through `Database.getDocument`, without and
+# with the document cache, optionally updating one of them every `--write-every` reads.
+
+import argparse
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Document import MutableDocument
+
+
+def profile(i):
+    return {"name": "user %d" % i, "email": "user%d@example.com" % i,
+            "settings": {"theme": "dark", "locale": "en_US", "flags": list(range(20))},
+            "roles": ["reader", "writer"] if i % 2 else ["reader"]}
+
+
+def run(db, hot, iterations, writeEvery):
+    start = time.perf_counter()
+    for i in range(iterations):
+        docID = "user-%d" % (i % hot)
+        if writeEvery and i % writeEvery == 0:
+            doc = MutableDocument(docID)
+            doc.properties = profile(i)
+            db.saveDocument(doc, 0)
+        doc = db.getDocument(docID)
+        doc.properties["settings"]["theme"]
+    return iterations / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Document read cache benchmark")
+    parser.add_argument('--hot', type=int, default=100, help="number of distinct documents read")
+    parser.add_argument('--iterations', type=int, default=200000, help="number of reads")
+    parser.add_argument('--write-every', type=int, default=0, help="update a document every N reads")
+    parser.add_argument('--cache-size', type=int, default=1000, help="documents the cache holds")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_doccache", args.dir)
+    db = Database("bench_doccache", DatabaseConfiguration(args.dir))
+    db.saveDocuments(("user-%d" % i, profile(i)) for i in range(args.hot))
+
+    uncached = run(db, args.hot, args.iterations, args.write_every)
+    cache = db.enableDocumentCache(args.cache_size)
+    cached = run(db, args.hot, args.iterations, args.write_every)
+    print("%d hot documents, %d reads, a write every %s reads" % (args.hot, args.iterations,
+                                                                 args.write_every or "no"))
+    print("%-24s %12.0f reads/s" % ("uncached", uncached))
+    print("%-24s %12.0f reads/s  (%.1fx)" % ("document cache", cached, cached / uncached))
+    print(cache.stats())
+
+    db.close()
+    Database.deleteFile("bench_doccache", args.dir)
@@ -0,0 +1,70 @@
+#! /usr/bin/env python3
+#
+#  incremental.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures saves/sec when bumping a counter and a timestamp on large documents, saving just
+# the changes (the default) versus re-encoding all the properties.
+
+import argparse
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+
+
+def makeProperties(i, width):
+    props = {"counter": 0, "updated": 0.0, "stats": {"hits": 0}}
+    for f in range(width):
+        props["field%d" % f] = {"text": "value %d of doc %d" % (f, i), "list": [f, f + 1]}
+    return props
+
+
+def bump(db, count, reencode):
+    start = time.perf_counter()
+    with db:
+        for i in range(count):
+            doc = db.getMutableDocument("doc-%06d" % i)
+            props = doc.properties
+            props["counter"] += 1
+            props["updated"] = time.time()
+            props["stats"]["hits"] += 1
+            if reencode:
+                doc.properties = dict(props)
+            db.saveDocument(doc)
+    return count / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Incremental save benchmark")
+    parser.add_argument('--docs', type=int, default=2000, help="number of documents")
+    parser.add_argument('--width', type=int, default=1000, help="number of top-level fields per doc")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_incremental", args.dir)
+    db = Database("bench_incremental", DatabaseConfiguration(args.dir))
+    db.saveDocuments(("doc-%06d" % i, makeProperties(i, args.width)) for i in range(args.docs))
+
+    full = bump(db, args.docs, True)
+    incremental = bump(db, args.docs, False)
+    print("%d docs, %d fields each" % (args.docs, args.width + 3))
+    print("%-20s %12.0f saves/s" % ("re-encode all", full))
+    print("%-20s %12.0f saves/s  (%.1fx)" % ("changes only", incremental, incremental / full))
+    assert db.getDocument("doc-000000")["counter"] == 2
+
+    db.close()
+    Database.deleteFile("bench_incremental", args.dir)
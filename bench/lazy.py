@@ -0,0 +1,65 @@
+#! /usr/bin/env python3
+#
+#  lazy.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures documents/sec when reading a few properties of large documents, with
+# eagerly decoded properties versus `Database.lazyProperties`.
+
+import argparse
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+
+
+def makeProperties(i, width):
+    props = {"type": "bench", "index": i, "owner": {"name": "user %d" % i, "id": i}}
+    for f in range(width):
+        props["field%d" % f] = ["value %d of doc %d" % (f, i), f, {"nested": f * 0.5}]
+    return props
+
+
+def readFew(db, count):
+    start = time.perf_counter()
+    for i in range(count):
+        doc = db.getDocument("doc-%06d" % i)
+        assert doc["index"] == i
+        doc["type"], doc["owner"]["name"], doc["field7"][1]
+    return count / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Lazy document properties benchmark")
+    parser.add_argument('--docs', type=int, default=2000, help="number of documents")
+    parser.add_argument('--width', type=int, default=2000, help="number of top-level fields per doc")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_lazy", args.dir)
+    db = Database("bench_lazy", DatabaseConfiguration(args.dir))
+    db.saveDocuments(("doc-%06d" % i, makeProperties(i, args.width)) for i in range(args.docs))
+
+    print("%d docs, %d fields each, reading 4 properties" % (args.docs, args.width + 3))
+    db.lazyProperties = False
+    eager = readFew(db, args.docs)
+    db.lazyProperties = True
+    lazy = readFew(db, args.docs)
+    print("%-20s %12.0f docs/s" % ("eager", eager))
+    print("%-20s %12.0f docs/s  (%.1fx)" % ("lazyProperties", lazy, lazy / eager))
+
+    db.close()
+    Database.deleteFile("bench_lazy", args.dir)
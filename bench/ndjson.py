@@ -0,0 +1,119 @@
+#! /usr/bin/env python3
+#
+#  ndjson.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures import and export of newline-delimited JSON in MB/s: `Database.importNDJSON` and
+# `exportNDJSON`, versus doing it in Python with `json.loads` + `saveDocuments` and
+# `Query.execute` + `asDictionary` + `json.dumps`. Also reports the growth in peak memory use
+# of each; the native versions stream, so theirs should stay flat however big the file is.
+
+import argparse
+import json
+import os
+import resource
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Query import N1QLQuery
+
+kMB = 1024 * 1024
+
+
+def peakMB():
+    # ru_maxrss is in KB on Linux, bytes on macOS
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return rss / (kMB if os.uname().sysname == "Darwin" else 1024)
+
+
+def measure(fn, size):
+    peak = peakMB()
+    start = time.perf_counter()
+    fn()
+    return size / kMB / (time.perf_counter() - start), peakMB() - peak
+
+
+def writeInput(path, mb):
+    count = 0
+    with open(path, "wb") as f:
+        while f.tell() < mb * kMB:
+            doc = {"_id": "doc-%09d" % count, "name": "user %d" % count, "age": count % 90,
+                   "score": count * 0.5, "active": (count % 3 == 0),
+                   "tags": ["t%d" % (count % 7), "t%d" % (count % 11)],
+                   "address": {"street": "%d Main St" % count, "city": "Springfield", "zip": "%05d" % (count % 100000)}}
+            f.write(json.dumps(doc).encode("utf-8") + b"\n")
+            count += 1
+    return count
+
+
+def openDatabase(name, dir):
+    Database.deleteFile(name, dir)
+    return Database(name, DatabaseConfiguration(dir))
+
+
+def importInPython(db, path):
+    with open(path, "rb") as f:
+        lines = (json.loads(line) for line in f)
+        assert db.saveDocuments(((props.pop("_id"), props) for props in lines), chunkSize=1000) == []
+
+
+def importNative(db, path):
+    assert db.importNDJSON(path, idField="_id", chunkSize=1000) == []
+
+
+def exportInPython(db, path):
+    with open(path, "w") as f:
+        for row in N1QLQuery(db, "SELECT meta().id, * FROM _").execute():
+            result = row.asDictionary()
+            props = result["_"]
+            props["_id"] = result["id"]
+            f.write(json.dumps(props) + "\n")
+
+
+def exportNative(db, path):
+    assert db.exportNDJSON(path, idField="_id") == db.count
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="NDJSON import/export benchmark")
+    parser.add_argument('--mb', type=int, default=1024, help="size of the JSON input in MB")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the databases and files in")
+    args = parser.parse_args()
+
+    inPath = os.path.join(args.dir, "bench_ndjson_in.json")
+    outPath = os.path.join(args.dir, "bench_ndjson_out.json")
+    count = writeInput(inPath, args.mb)
+    size = os.path.getsize(inPath)
+
+    # Native goes first, since peak memory use can only go up.
+    results = []
+    for name, importer, exporter in (("native", importNative, exportNative),
+                                     ("Python", importInPython, exportInPython)):
+        db = openDatabase("bench_ndjson", args.dir)
+        results.append(("import (%s)" % name, measure(lambda: importer(db, inPath), size)))
+        assert db.count == count
+        results.append(("export (%s)" % name, measure(lambda: exporter(db, outPath), size)))
+        db.close()
+        Database.deleteFile("bench_ndjson", args.dir)
+
+    print("%d MB of JSON, %d documents" % (size // kMB, count))
+    print("%-18s %10s %12s %14s" % ("", "MB/s", "docs/s", "peak mem +MB"))
+    for name, (mbps, mem) in results:
+        print("%-18s %10.1f %12.0f %14.0f" % (name, mbps, mbps * kMB * count / size, mem))
+
+    os.remove(inPath)
+    os.remove(outPath)
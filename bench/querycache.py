@@ -0,0 +1,62 @@
+#! /usr/bin/env python3
+#
+#  querycache.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures parameterized queries/sec when each query is compiled from scratch,
+# versus fetched from the database's compiled-query cache with `Database.query`.
+
+import argparse
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Query import N1QLQuery
+
+
+def queryText(i):
+    return "SELECT n FROM _ WHERE tag = $tag AND n >= %d" % i
+
+
+def run(db, getQuery, nQueries, iterations):
+    start = time.perf_counter()
+    for i in range(iterations):
+        query = getQuery(db, queryText(i % nQueries))
+        query.setParameters({"tag": "t%d" % (i % 10), "limit": 10, "extra": [i, str(i)]})
+        for row in query.execute():
+            pass
+    return iterations / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Compiled query cache benchmark")
+    parser.add_argument('--queries', type=int, default=40, help="number of distinct queries")
+    parser.add_argument('--iterations', type=int, default=20000, help="number of queries to run")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_querycache", args.dir)
+    db = Database("bench_querycache", DatabaseConfiguration(args.dir))
+    db.saveDocuments(("doc-%d" % i, {"n": i, "tag": "t%d" % (i % 10)}) for i in range(100))
+
+    uncached = run(db, lambda db, text: N1QLQuery(db, text), args.queries, args.iterations)
+    cached = run(db, lambda db, text: db.query(text), args.queries, args.iterations)
+    print("%d distinct queries, %d runs" % (args.queries, args.iterations))
+    print("%-24s %12.0f queries/s" % ("compiled every time", uncached))
+    print("%-24s %12.0f queries/s  (%.1fx)" % ("Database.query cache", cached, cached / uncached))
+
+    db.close()
+    Database.deleteFile("bench_querycache", args.dir)
@@ -0,0 +1,109 @@
+#! /usr/bin/env python3
+#
+#  replfilter.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures filtered push replication to a local database, in docs/s of source documents, with
+# no filter, a native ReplicationFilter, the equivalent Python filter function, and native rules
+# followed by a Python callback. With `--busy N`, N threads keep the GIL busy meanwhile, as an
+# application would; that slows the Python filter down, but not the native one.
+#
+# Replicating with a local database needs the Enterprise Edition (`build.sh --edition EE`).
+
+import argparse
+import threading
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Replicator import Replicator, ReplicatorConfiguration, ReplicationFilter, Push
+
+
+def openDatabase(name, dir):
+    Database.deleteFile(name, dir)
+    return Database(name, DatabaseConfiguration(dir))
+
+
+def populate(db, count):
+    # Half the docs are orders, of which a third are open; so 1 in 6 docs passes the filters
+    def entries():
+        for i in range(count):
+            if i % 2 == 0:
+                yield ("order:%d" % i, {"type": "order", "status": ("open" if i % 3 == 0 else "shipped"),
+                                        "total": i * 0.25, "items": [{"sku": "A%d" % (i % 50)}]})
+            else:
+                yield ("user:%d" % i, {"type": "user", "name": "user %d" % i})
+    assert db.saveDocuments(entries()) == []
+    return sum(1 for i in range(count) if i % 2 == 0 and i % 3 == 0)
+
+
+def busyWork(stop):
+    n = 0
+    while not stop.is_set():
+        n = sum(i * i for i in range(1000))
+
+
+def push(source, dir, pushFilter, expected):
+    target = openDatabase("bench_replfilter_target", dir)
+    config = ReplicatorConfiguration(source, target, push_filter=pushFilter)
+    config.replicator_type = Push
+    config.continuous = False
+    replicator = Replicator(config)
+    replicator.start()
+    assert replicator.waitForIdle(600), "replication timed out"
+    metrics = replicator.metrics()
+    replicated = target.count
+    replicator.stop()
+    del replicator
+    target.close()
+    Database.deleteFile("bench_replfilter_target", dir)
+    assert replicated == expected, "replicated %d docs, expected %d" % (replicated, expected)
+    assert metrics["errors"] == 0, metrics["errorsByCollection"]
+    return metrics["timeToIdle"]
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Filtered push replication benchmark")
+    parser.add_argument('--docs', type=int, default=100000, help="number of documents in the source database")
+    parser.add_argument('--busy', type=int, default=0, help="number of threads running Python code meanwhile")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the databases in")
+    args = parser.parse_args()
+
+    source = openDatabase("bench_replfilter", args.dir)
+    expected = populate(source, args.docs)
+
+    cases = (
+        ("none", None, args.docs),
+        ("native", ReplicationFilter().idPrefix("order:").equals("status", "open"), expected),
+        ("Python", lambda doc, flags: doc.id.startswith("order:") and doc["status"] == "open", expected),
+        ("native + Python", ReplicationFilter().idPrefix("order:")
+                                .callback(lambda doc, flags: doc["status"] == "open"), expected),
+    )
+
+    stop = threading.Event()
+    busy = [threading.Thread(target=busyWork, args=(stop,), daemon=True) for i in range(args.busy)]
+    for thread in busy:
+        thread.start()
+
+    print("%d documents, %d pass the filters, %d busy threads" % (args.docs, expected, args.busy))
+    print("%-18s %10s %12s" % ("filter", "seconds", "docs/s"))
+    try:
+        for name, pushFilter, count in cases:
+            elapsed = push(source, args.dir, pushFilter, count)
+            print("%-18s %10.3f %12.0f" % (name, elapsed, args.docs / elapsed))
+    finally:
+        stop.set()
+        source.close()
+        Database.deleteFile("bench_replfilter", args.dir)
@@ -0,0 +1,237 @@
+#! /usr/bin/env python3
+#
+#  suite.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Runs a benchmark of each of the binding's hot paths against a local database, and writes the
+# results as JSON. Every result is a rate, so bigger is better. With `--compare baseline.json`
+# it also flags results that are more than `--threshold` percent slower than the baseline, and
+# exits with status 1 if there are any.
+#
+#   bench/bench.sh suite.py --out baseline.json
+#   ...change something...
+#   bench/bench.sh suite.py --compare baseline.json
+
+import argparse
+import json
+import os
+import platform
+import sys
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Document import MutableDocument
+from CouchbaseLite.Blob import BlobWriter
+
+kMB = 1024 * 1024
+
+
+def timed(fn):
+    """Calls `fn`, which returns a number of items processed, and returns items/sec.
+       Takes the best of three runs, to smooth out noise."""
+    best = 0
+    for run in range(3):
+        start = time.perf_counter()
+        n = fn()
+        best = max(best, n / (time.perf_counter() - start))
+    return best
+
+
+def nestedValue(depth, width):
+    if depth == 0:
+        return "leaf"
+    return {"k%d" % i: nestedValue(depth - 1, width) for i in range(width)}
+
+
+class Suite:
+    def __init__(self, dir, docs):
+        self.dir = dir
+        self.docs = docs
+        self.results = {}
+        Database.deleteFile("bench_suite", dir)
+        self.db = Database("bench_suite", DatabaseConfiguration(dir))
+
+    def close(self):
+        self.db.close()
+        Database.deleteFile("bench_suite", self.dir)
+
+    def record(self, name, rate, unit):
+        self.results[name] = {"value": rate, "unit": unit}
+        print("%-36s %14.1f %s" % (name, rate, unit))
+
+    def props(self, i):
+        return {"type": "user", "n": i, "name": "user %d" % i, "score": i * 0.5,
+                "active": (i % 2 == 0), "tags": ["a", "b", "c"], "address": {"city": "Springfield", "zip": i % 100000}}
+
+    def benchSaves(self):
+        count = self.docs // 10
+        run = [0]
+        def single():
+            run[0] += 1
+            for i in range(count):
+                doc = MutableDocument("single-%d-%d" % (run[0], i))
+                doc.properties = self.props(i)
+                self.db.saveDocument(doc)
+            return count
+        self.record("save.single", timed(single), "docs/s")
+
+        def batched():
+            run[0] += 1
+            entries = (("batch-%d-%d" % (run[0], i), self.props(i)) for i in range(self.docs))
+            assert self.db.saveDocuments(entries) == []
+            return self.docs
+        self.record("save.batched", timed(batched), "docs/s")
+
+    def ensureDocs(self):
+        # The gets and queries read the documents written by the first batched save
+        if self.db.getDocument("batch-1-0") is None:
+            entries = (("batch-1-%d" % i, self.props(i)) for i in range(self.docs))
+            assert self.db.saveDocuments(entries) == []
+
+    def benchGets(self):
+        self.ensureDocs()
+        def get():
+            for i in range(self.docs):
+                self.db.getDocument("batch-1-%d" % i).properties
+            return self.docs
+        self.record("get.byID", timed(get), "docs/s")
+
+        ids = ["batch-1-%d" % i for i in range(self.docs)]
+        self.record("get.multi", timed(lambda: len(self.db.getDocuments(ids))), "docs/s")
+
+    def benchDecodeSweeps(self):
+        count = 1000
+        for depth, width in ((1, 10), (1, 100), (1, 1000), (2, 10), (4, 4), (8, 2)):
+            entries = (("decode-%d-%d-%d" % (depth, width, i), {"v": nestedValue(depth, width)})
+                       for i in range(count))
+            assert self.db.saveDocuments(entries) == []
+            ids = ["decode-%d-%d-%d" % (depth, width, i) for i in range(count)]
+            def decode():
+                for id in ids:
+                    self.db.getDocument(id).properties
+                return count
+            self.record("decode.depth%d.width%d" % (depth, width), timed(decode), "docs/s")
+
+    def benchQueries(self):
+        self.ensureDocs()
+        query = self.db.query("SELECT n, name, score FROM _ WHERE meta().id LIKE 'batch-1-%'")
+        def execute():
+            return sum(1 for row in query.execute() if row.asDictionary())
+        self.record("query.execute+decode", timed(execute), "rows/s")
+        self.record("query.columnar", timed(lambda: len(query.executeColumnar()["n"])), "rows/s")
+
+        query = self.db.query("SELECT name FROM _ WHERE n = $n AND type = 'user'")
+        def reexecute():
+            for i in range(1000):
+                query.setParameters({"n": i})
+                for row in query.execute():
+                    row["name"]
+            return 1000
+        self.record("query.parameterized", timed(reexecute), "queries/s")
+
+    def benchBlobs(self):
+        data = os.urandom(16 * kMB)
+        blobs = []
+        def write():
+            with BlobWriter(self.db) as writer:
+                for i in range(0, len(data), kMB):
+                    writer.write(data[i : i + kMB])
+            blobs.append(writer.blob)
+            return len(data) / kMB
+        self.record("blob.write", timed(write), "MB/s")
+        doc = MutableDocument("blob-holder")
+        doc["att"] = blobs[0]
+        self.db.saveDocument(doc)
+        blob = self.db.getDocument("blob-holder")["att"]
+        def read():
+            n = 0
+            with blob.openStream() as reader:
+                while chunk := reader.read(kMB):
+                    n += len(chunk)
+            return n / kMB
+        self.record("blob.read", timed(read), "MB/s")
+
+    def benchListeners(self):
+        count = self.docs // 10
+        for buffered in (False, True):
+            received = [0]
+            token = self.db.addListener(lambda ids: received.__setitem__(0, received[0] + len(ids)),
+                                        buffered=buffered)
+            run = [0]
+            def deliver():
+                run[0] += 1
+                received[0] = 0
+                for i in range(count):
+                    self.db.saveDocument(MutableDocument("listen-%d-%d-%d" % (buffered, run[0], i)))
+                deadline = time.monotonic() + 10
+                while received[0] < count and time.monotonic() < deadline:
+                    time.sleep(0.001)
+                return received[0]
+            self.record("listener.%s" % ("buffered" if buffered else "direct"), timed(deliver), "changes/s")
+            token.remove()
+
+    def run(self, only):
+        for name in ("saves", "gets", "decodeSweeps", "queries", "blobs", "listeners"):
+            if not only or name in only:
+                getattr(self, "bench" + name[0].upper() + name[1:])()
+
+
+def compare(results, baseline, threshold):
+    """Prints each result next to its baseline; returns the names of the regressions."""
+    regressions = []
+    print("\n%-36s %14s %14s %8s" % ("", "baseline", "current", "change"))
+    for name, result in results.items():
+        base = baseline.get(name)
+        if not base or not base["value"]:
+            continue
+        change = 100.0 * (result["value"] - base["value"]) / base["value"]
+        flag = ""
+        if change < -threshold:
+            regressions.append(name)
+            flag = "  <-- REGRESSION"
+        print("%-36s %14.1f %14.1f %+7.1f%%%s" % (name, base["value"], result["value"], change, flag))
+    return regressions
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Benchmark suite for the binding's hot paths")
+    parser.add_argument('--docs', type=int, default=20000, help="number of documents for bulk benchmarks")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    parser.add_argument('--only', nargs="*", help="run only these groups: saves gets decodeSweeps queries blobs listeners")
+    parser.add_argument('--out', help="file to write the results to as JSON")
+    parser.add_argument('--compare', help="baseline results JSON file to compare against")
+    parser.add_argument('--threshold', type=float, default=10.0, help="percent slowdown counted as a regression")
+    args = parser.parse_args()
+
+    suite = Suite(args.dir, args.docs)
+    try:
+        suite.run(args.only)
+    finally:
+        suite.close()
+
+    output = {"python": platform.python_version(), "platform": platform.platform(),
+              "time": time.strftime("%Y-%m-%dT%H:%M:%S"), "docs": args.docs, "results": suite.results}
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(output, f, indent=2, sort_keys=True)
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)["results"]
+        regressions = compare(suite.results, baseline, args.threshold)
+        if regressions:
+            print("\n%d regression(s): %s" % (len(regressions), ", ".join(regressions)))
+            sys.exit(1)
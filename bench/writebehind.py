@@ -0,0 +1,87 @@
+#! /usr/bin/env python3
+#
+#  writebehind.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Measures a telemetry-style workload, where each of `--threads` writers keeps updating a few
+# documents, saved one `saveDocument` (and so one commit) at a time, versus through a
+# WriteBehindQueue, which coalesces updates to the same document and commits in groups.
+
+import argparse
+import threading
+import time
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration
+from CouchbaseLite.Document import MutableDocument, LastWriteWins
+
+
+def sample(writer, i):
+    return {"sensor": writer, "seq": i, "value": (i * 7919) % 1000 / 10.0, "ts": time.time()}
+
+
+def writeDirect(db, writer, updates, docs):
+    for i in range(updates):
+        doc = MutableDocument("sensor-%d-%d" % (writer, i % docs))
+        doc.properties = sample(writer, i)
+        db.saveDocument(doc, LastWriteWins)
+
+
+def writeBehind(db, writer, updates, docs):
+    queue = db.writeBehindQueue
+    for i in range(updates):
+        future = queue.put("sensor-%d-%d" % (writer, i % docs), sample(writer, i))
+    future.result()
+
+
+def run(db, write, threads, updates, docs):
+    workers = [threading.Thread(target=write, args=(db, t, updates, docs)) for t in range(threads)]
+    start = time.perf_counter()
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    return threads * updates / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Write-behind queue benchmark")
+    parser.add_argument('--threads', type=int, default=4, help="number of writer threads")
+    parser.add_argument('--updates', type=int, default=5000, help="updates per writer")
+    parser.add_argument('--docs', type=int, default=10, help="documents each writer updates")
+    parser.add_argument('--max-batch', type=int, default=1000, help="most documents per commit")
+    parser.add_argument('--max-latency', type=float, default=0.05, help="longest wait before a commit (s)")
+    parser.add_argument('--dir', default="/tmp", help="directory to create the database in")
+    args = parser.parse_args()
+
+    Database.deleteFile("bench_writebehind", args.dir)
+    db = Database("bench_writebehind", DatabaseConfiguration(args.dir))
+    total = args.threads * args.updates
+
+    direct = run(db, writeDirect, args.threads, args.updates, args.docs)
+    queue = db.enableWriteBehind(maxBatch=args.max_batch, maxLatency=args.max_latency)
+    behind = run(db, writeBehind, args.threads, args.updates, args.docs)
+    stats = queue.stats()
+    db.disableWriteBehind()
+
+    print("%d writers x %d updates to %d docs each" % (args.threads, args.updates, args.docs))
+    print("%-16s %12.0f updates/s %8d commits" % ("saveDocument", direct, total))
+    print("%-16s %12.0f updates/s %8d commits  (%.1fx, %.0f docs/commit, %d coalesced)" % (
+          "write-behind", behind, stats["commits"], behind / direct, stats["docsPerCommit"],
+          stats["coalesced"]))
+
+    db.close()
+    Database.deleteFile("bench_writebehind", args.dir)
@@ -73,6 +73,30 @@ def BuildLibrary(includeDir, python_includedir, lib_path, libraries, extra_link_
     os.remove("_PyCBL.c")
     os.remove("_PyCBL.o")
 
+    BuildNativeLibrary(include_dirs, libraries, extra_link_args, verbose)
+
+
+def BuildNativeLibrary(include_dirs, libraries, extra_link_args, verbose):
+    # The native helpers in CBLForPython_Native.c create Python objects directly, which CFFI
+    # can't do, so they're built as a regular extension module `_PyCBLNative` instead,
+    # against the same CBL headers and library as `_PyCBL`.
+    from setuptools import Distribution, Extension
+
+    extension = Extension(
+        "_PyCBLNative",
+        sources=[os.path.abspath("../CBLForPython_Native.c")],
+        libraries=libraries,
+        include_dirs=include_dirs,
+        library_dirs=["."],
+        extra_link_args=extra_link_args or [])
+    dist = Distribution({"name": "_PyCBLNative", "ext_modules": [extension]})
+    dist.verbose = verbose
+    buildCommand = dist.get_command_obj("build_ext")
+    buildCommand.inplace = True
+    dist.run_command("build_ext")
+
+    shutil.rmtree("build", ignore_errors=True)
+
 
 def CDeclarations(buildEE):
     f = open("../CBLForPython.h", "rb", buffering=0)
@@ -0,0 +1,127 @@
+#! /usr/bin/env python3
+#
+#  stress.py
+#
+# Copyright (c) 2019-2021 Couchbase, Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Multithreaded tests: errors must be reported to the thread that caused them,
+# and reads through a DatabasePool should scale with the number of reader handles.
+
+from CouchbaseLite.Database import Database, DatabaseConfiguration, DatabasePool
+from CouchbaseLite.Document import MutableDocument
+from CouchbaseLite.Query import N1QLQuery
+from CouchbaseLite.common import CBLException
+import os
+import threading
+import time
+
+kThreads = 8
+kIterations = 500
+kDocs = 1000
+kBatch = 100
+
+Database.deleteFile("stress", "/tmp")
+config = DatabaseConfiguration("/tmp")
+pool = DatabasePool("stress", config, readers=kThreads)
+print ("pool  = ", pool)
+
+with pool.write() as db:
+    for i in range(kDocs):
+        doc = MutableDocument("doc-%d" % i)
+        doc["i"] = i
+        db.saveDocument(doc)
+db = pool.writer
+assert(db.count == kDocs)
+
+
+######## ERROR ATTRIBUTION
+
+# Operations that each fail with a different error:
+def purgeMissing():
+    db.purgeDocument("no-such-doc")
+
+def badQuery():
+    N1QLQuery(db, "SELECT FROM WHERE")
+
+def conflict():
+    doc = MutableDocument("doc-0")
+    doc["i"] = -1
+    db.saveDocument(doc)
+
+def succeed():
+    assert(db.getDocument("doc-1")["i"] == 1)
+
+def errorOf(op):
+    try:
+        op()
+    except CBLException as x:
+        return (x.domain, x.code)
+    return None
+
+# Learn the expected errors single-threaded first:
+expected = {op: errorOf(op) for op in [purgeMissing, badQuery, conflict, succeed]}
+print ("expected errors = ", {op.__name__: error for op, error in expected.items()})
+assert(expected[succeed] is None)
+assert(None not in [expected[purgeMissing], expected[badQuery], expected[conflict]])
+assert(len(set(expected.values())) == len(expected))
+
+misattributed = []
+
+def hammer(op):
+    for i in range(kIterations):
+        error = errorOf(op)
+        if error != expected[op]:
+            misattributed.append((op.__name__, error))
+
+ops = list(expected.keys())
+threads = [threading.Thread(target=hammer, args=(ops[t % len(ops)],)) for t in range(kThreads)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
+print ("misattributed errors = ", misattributed[:10])
+assert(misattributed == [])
+
+
+######## READ SCALING
+
+ids = ["doc-%d" % i for i in range(kDocs)]
+
+def read(count):
+    for n in range(count):
+        with pool.reader() as reader:
+            start = (n * kBatch) % kDocs
+            docs = reader.getDocuments(ids[start : start + kBatch])
+            assert(docs[0]["i"] == start)
+
+def readThroughput(nThreads):
+    perThread = kIterations // nThreads
+    threads = [threading.Thread(target=read, args=(perThread,)) for t in range(nThreads)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return nThreads * perThread * kBatch / (time.perf_counter() - start)
+
+# This is informational only, since the speedup depends on the machine it runs on.
+single = readThroughput(1)
+multi = readThroughput(min(kThreads, os.cpu_count() or 1))
+print ("reads/sec: %.0f with 1 reader, %.0f with %d readers (%.1fx)"
+       % (single, multi, min(kThreads, os.cpu_count() or 1), multi / single))
+
+pool.close()
+Database.deleteFile("stress", "/tmp")
@@ -19,8 +19,19 @@
 
 from CouchbaseLite.Database import Database, DatabaseConfiguration, IndexConfiguration, FullTextIndexConfiguration
 from CouchbaseLite.Document import Document, MutableDocument
-from CouchbaseLite.Query import JSONQuery, N1QLLanguage, JSONLanguage
+from CouchbaseLite.Blob import Blob, BlobWriter
+from CouchbaseLite.Query import JSONQuery, N1QLQuery, N1QLLanguage, JSONLanguage
+from CouchbaseLite.aio import AsyncDatabase, AsyncBlob
+from CouchbaseLite.Replicator import Replicator, ReplicatorConfiguration, ReplicationFilter, DocumentFlagsDeleted, Push
+from CouchbaseLite.Maintenance import MaintenanceScheduler, Compact, Optimize, IntegrityCheck
+from CouchbaseLite.IndexAdvisor import IndexAdvisor, IndexSuggestion
+from CouchbaseLite._PyCBL import lib
+from CouchbaseLite.common import CBLException, CBLErrorNotFound
+import array
+import asyncio
 import json
+import threading
+import time
 
 Database.deleteFile("db", "/tmp")
 
@@ -137,9 +148,42 @@ with db:
     assert(canonicalJSON(update_doc.JSON) == """{"a": "b", "array": ["a"], "empty_array": [], "empty_obj": {}, "flat": "flat", "nested": {"foo": "bar", "nested": "nested"}}""")
     db.saveDocument(update_doc)
 
+    assert(db.getDocument('nested_doc')['nested'] == {'foo': 'bar', 'nested': 'nested'})
+    assert(db.getDocument('nested_doc')['a'] == 'b')
+
 
 dbListenerToken.remove()
 
+failures = db.saveDocuments((("bulk-%d" % i, {"i": i}) for i in range(10)), chunkSize=4)
+assert(failures == [])
+assert(db.getDocument("bulk-7")["i"] == 7)
+failures = db.saveDocuments([("bulk-1", {"i": -1})])
+assert(len(failures) == 1 and failures[0][0][0] == "bulk-1")   # conflict
+
+assert(db.getDocuments(["bulk-2", "nope", "bulk-3"]) == [{"i": 2}, None, {"i": 3}])
+assert(db.getDocuments(["bulk-4"], decode=False)[0]["i"] == 4)
+assert(db.getDocuments(["bulk-2", "bulk-3"], snapshot=True) == [{"i": 2}, {"i": 3}])
+
+db.lazyProperties = True
+lazyDoc = db.getDocument("nested_doc")
+assert(lazyDoc["nested"]["foo"] == "bar" and lazyDoc["array"][0] == "a")
+assert(lazyDoc.properties == db.getMutableDocument("nested_doc").properties)
+db.lazyProperties = False
+
+blobDoc = MutableDocument("blob_doc")
+blobDoc["att"] = Blob(b"hello blob", contentType="text/plain")
+db.saveDocument(blobDoc)
+att = db.getDocument("blob_doc")["att"]
+assert(att.length == 10 and bytes(att.content) == b"hello blob")
+with att.openStream() as reader:
+    reader.seek(6)
+    assert(reader.read() == b"blob" and reader.tell() == 10)
+
+with BlobWriter(db, "text/plain") as writer:
+    writer.write(b"hello ")
+    writer.write(b"stream")
+assert(writer.blob.data == b"hello stream" and writer.blob.contentType == "text/plain")
+
 q = JSONQuery(db, {'WHAT': [['.flavor'], ['.numbers']], 'WHERE': ['=', ['.color'], 'green']})
 print ("-------- Explanation --------")
 print (q.explanation)
@@ -149,4 +193,262 @@ print ("Columns: ", q.columnNames)
 for row in q.execute():
     print ("row: ", row.asArray(), "  ...or...  ", row.asDictionary())
 
+columns = q.executeColumnar()
+assert(list(columns.keys()) == q.columnNames)
+assert(sorted(columns["flavor"]) == ["cardamom", "pumpkin spice"])
+
+columns = N1QLQuery(db, "SELECT i FROM _ WHERE meta().id LIKE 'bulk-%' ORDER BY i").executeColumnar()
+assert(columns["i"] == array.array('q', range(10)))
+db.saveDocuments([("big-1", {"big": 2 ** 53 + 1}), ("big-2", {"big": 2 ** 64 - 1})], 2)
+columns = N1QLQuery(db, "SELECT big FROM _ WHERE meta().id LIKE 'big-%' ORDER BY meta().id").executeColumnar()
+assert(columns["big"] == [2 ** 53 + 1, 2 ** 64 - 1] and type(columns["big"][0]) is int)
+
+q = db.query("SELECT i FROM _ WHERE i = $i")
+assert(db.query("SELECT i FROM _ WHERE i = $i") is q)
+otherThreadQuery = []
+queryThread = threading.Thread(target=lambda: otherThreadQuery.append(db.query("SELECT i FROM _ WHERE i = $i")))
+queryThread.start(); queryThread.join()
+assert(otherThreadQuery[0] is not q and otherThreadQuery[0].sourceCode == q.sourceCode)
+q.setParameters({"i": 5})
+assert(q.executeColumnar()["i"] == array.array('q', [5]))
+
+with open("/tmp/test.ndjson", "wb") as f:
+    f.write(b'{"_id": "nd-1", "n": 1}\n\n{"_id": "nd-2", "n": [2]}\nnot json\n{"_id": 3}\n')
+failures = db.importNDJSON("/tmp/test.ndjson", idField="_id", chunkSize=2)
+assert([line for line, exception in failures] == [4, 5])
+assert(db.getDocument("nd-2")["n"] == [2])
+assert(db.exportNDJSON("/tmp/test.ndjson", "SELECT n FROM _ WHERE meta().id LIKE 'nd-%' ORDER BY n") == 2)
+with open("/tmp/test.ndjson", "rb") as f:
+    assert([json.loads(line) for line in f] == [{"n": 1}, {"n": [2]}])
+exportProgress = []
+count = db.exportNDJSON("/tmp/test.ndjson", progress=exportProgress.append)
+assert(count == db.count and exportProgress and exportProgress[-1] == count)
+with open("/tmp/test.ndjson", "rb") as f:
+    assert({"_id": "nd-1", "n": 1} in [json.loads(line) for line in f])
+
+
+batches = []
+delivered = threading.Event()
+bufferedToken = db.addListener(lambda docIDs: (batches.append(docIDs), delivered.set()), buffered=True)
+db.saveDocument(MutableDocument("buf-2"))
+for i in range(3):
+    doc = db.getMutableDocument("buf-1") if i else MutableDocument("buf-1")
+    doc["n"] = i
+    db.saveDocument(doc)
+assert(delivered.wait(5))
+time.sleep(0.2)
+assert(sorted(set(sum(batches, []))) == ["buf-1", "buf-2"])
+assert(all(len(docIDs) == len(set(docIDs)) for docIDs in batches))
+bufferedToken.remove()
+assert(db._changeBuffer is None)
+
+
+async def aioTest():
+    adb = AsyncDatabase(db)
+    doc = MutableDocument("aio-1")
+    doc["n"] = 1
+    await adb.save(doc)
+    assert((await adb.getDocument("aio-1"))["n"] == 1)
+    rows = [row async for row in adb.query("SELECT n FROM _ WHERE meta().id = 'aio-1'").execute(batchSize=1)]
+    assert(rows == [{"n": 1}])
+    blob = AsyncBlob(adb, db.getDocument("blob_doc")["att"])
+    assert(await blob.read(5) == b"hello" and await blob.read() == b" blob")
+    await blob.close()
+    adb.executor.shutdown()
+asyncio.run(aioTest())
+
+
+assert(db.stats() is None)
+db.enableStats()
+db.getDocument("bulk-1").properties
+db.query("SELECT i FROM _ WHERE i = $i").setParameters({"i": 1})
+stats = db.stats(reset=True)
+assert(stats["latency"]["document.get"]["count"] == 1 and stats["counters"]["fleece.decode.bytes"] > 0)
+assert(stats["counters"]["fleece.encode.bytes"] > 0)
+assert(db.stats() == {"counters": {}, "latency": {}})
+db.enableStats(False)
+
+
+orders = db.collection("orders", "store")
+assert(repr(orders) == "Collection['store.orders']" and db.collectionNames("store") == ["orders"])
+assert(orders.saveDocuments((("order-%d" % i, {"total": i}) for i in range(5))) == [])
+assert(orders.count == 5 and orders.getDocument("order-3")["total"] == 3)
+assert(db.getDocument("order-3") is None)
+orders.createIndex("totals", IndexConfiguration(N1QLLanguage, "total"))
+assert(orders.getIndexNames() == ["totals"])
+assert(db.query("SELECT total FROM store.orders WHERE total >= 3 ORDER BY total").executeColumnar()["total"] == array.array('q', [3, 4]))
+orders.deleteDocument("order-4")
+assert(orders.count == 4)
+defaultCount = db.count
+orderDoc = orders.getMutableDocument("order-3")
+orderDoc["total"] = 33
+db.enableStats()
+orderDoc.save()
+stats = db.stats()
+db.enableStats(False)
+assert(stats["latency"]["fleece.encode"]["count"] == 1 and stats["latency"]["document.save"]["count"] == 1)
+assert(orders.getDocument("order-3")["total"] == 33 and orders.count == 4)
+assert(db.getDocument("order-3") is None and db.count == defaultCount)
+orders.getDocument("order-2").delete(db)
+assert(orders.count == 3 and orders.getDocument("order-2") is None)
+try:
+    orders.deleteDocument("no-such-order")
+    assert(False)
+except CBLException as x:
+    assert(x.code == CBLErrorNotFound)
+
+
+orderDoc = MutableDocument("deep-order")
+orderDoc["order"] = {"items": [{"sku": "A"}, {"sku": "B"}], "total": 9}
+db.saveDocument(orderDoc)
+assert(db.getDocument("deep-order").getPath("order.items[1].sku") == "B")
+assert(db.getDocument("deep-order").getPath("order.nope", "?") == "?")
+assert(orderDoc.getPath("order.items[-1].sku") == "B")
+assert(db.project(["deep-order", "nope"], ["order.total", "order.items[0].sku", "x"]) == [(9, "A", None), None])
+
+
+deepOrder = db.getDocument("deep-order")
+assert(ReplicationFilter().idPrefix("x", "deep-").equals("order.total", 9).exists("order.items[1]").matches(deepOrder))
+assert(not ReplicationFilter().isIn("order.items[0].sku", ["B", "C"]).matches(deepOrder))
+assert(ReplicationFilter().docIDs(["deep-order"]).idPrefix("order-", negate=True).matches(deepOrder))
+assert(not ReplicationFilter().deleted().matches(deepOrder))
+assert(ReplicationFilter(passDeletions=True).exists("nope").matches(deepOrder, DocumentFlagsDeleted))
+nullDoc = MutableDocument("null-order")
+nullDoc["status"] = None
+db.saveDocument(nullDoc)
+nullDoc = db.getDocument("null-order")
+assert(ReplicationFilter().equals("status", None).matches(nullDoc))
+assert(not ReplicationFilter().equals("status", None, negate=True).matches(nullDoc))
+assert(not ReplicationFilter().equals("order.total", None).matches(deepOrder))
+seen = []
+pyFilter = ReplicationFilter().exists("order").callback(lambda doc, flags: seen.append(doc.id) or False)
+assert(not pyFilter.matches(deepOrder) and seen == ["deep-order"])
+
+
+db.performMaintenance(IntegrityCheck)
+reports = []
+scheduler = MaintenanceScheduler(db, optimizeAfterWrites=5, compactAfterDeletes=2, idleTime=0, onReport=reports.append)
+assert(scheduler.check() == [])
+db.saveDocuments(("maint-%d" % i, {"i": i}) for i in range(5))
+db.purgeDocument("maint-0")
+db.purgeDocument("maint-1")
+assert(scheduler.due() == [Compact, Optimize])
+assert([r.type for r in scheduler.check()] == [Compact, Optimize] and len(reports) == 2)
+assert(reports[0].sizeBefore > 0 and reports[0].sizeAfter > 0 and reports[0].deletes == 2 and reports[0].error is None)
+assert(scheduler.due() == [] and scheduler.pending["optimize"] == (0, 0))
+
+
+advisor = IndexAdvisor(db)
+advisedQuery = db.query("SELECT name FROM _ WHERE kind = 'advised' ORDER BY name")
+assert(advisedQuery.plan.fullScans and advisedQuery.plan.sortsWithoutIndex)
+assert([s.expressions for s in advisor.suggestions()] == [["kind", "name"]])
+assert(advisor.suggestions()[0].reasons == {"full scan", "sort"})
+assert(not IndexSuggestion("store", "dropped", ["total"]).create(db))
+advisor.autoCreate = True
+assert(advisor.observe(advisedQuery) and "auto_kind_name" in db.getIndexNames())
+advisedPlan = db.query("SELECT name FROM _ WHERE kind = 'advised' ORDER BY name").plan
+assert(advisedPlan.indexesUsed == ["auto_kind_name"] and not advisedPlan.fullScans)
+advisor.detach()
+
+
+import queue
+liveChanges = queue.Queue()
+db.saveDocuments(("live-%d" % i, {"kind": "live", "n": i}) for i in range(3))
+liveQuery = N1QLQuery(db, "SELECT meta().id, n FROM _ WHERE kind = 'live' ORDER BY n")
+liveToken = liveQuery.addResultsListener(liveChanges.put, key="id")
+change = liveChanges.get(timeout=5)
+assert(change.error is None and sorted(change.added) == ["live-0", "live-1", "live-2"] and not change.changed)
+firstRows = change.rows
+with db:
+    liveDoc = db.getMutableDocument("live-1")
+    liveDoc["n"] = 10
+    db.saveDocument(liveDoc)
+    db.purgeDocument("live-0")
+change = liveChanges.get(timeout=5)
+assert(change.rows[-1] == ("live-1", 10) and change.changed == {"live-1": ("live-1", 10)})
+assert(change.removed == {"live-0": ("live-0", 0)} and change.added == {})
+assert(change.rows[0] is firstRows[2])      # unchanged, so not decoded again
+assert(change.asDictionaries()[0] == {"id": "live-2", "n": 2})
+liveToken.remove()
+
+
+docCache = db.enableDocumentCache(maxDocuments=2)
+cachedDoc = db.getDocument("live-1")
+assert(db.getDocument("live-1") is cachedDoc and docCache.hits == 1 and docCache.misses == 1)
+assert(cachedDoc["n"] == 10 and cachedDoc.getPath("n") == 10)
+try:
+    cachedDoc.properties["n"] = 11
+    assert(False)
+except TypeError:
+    pass
+liveDoc = cachedDoc.mutableCopy()
+liveDoc["n"] = 11
+db.saveDocument(liveDoc)
+assert("live-1" not in docCache and db.getDocument("live-1")["n"] == 11)
+db.getDocument("live-2")
+db.getDocument("maint-2")
+assert(len(docCache) == 2 and docCache.stats()["evictions"] == 1)
+assert(db.getDocument("no-such-doc") is None)
+# In buffered-notification mode the change listener lags; writes through `db` must still
+# invalidate right away, and others are caught by checking sequences.
+laggingToken = db.addListener(lambda docIDs: None, buffered=True)
+docCache.maxDocuments = 10
+assert(db.getDocument("live-2")["n"] == 2)
+db.saveDocuments([("live-2", {"kind": "live", "n": 20})])
+assert(db.getDocument("live-2")["n"] == 20)
+defaultDoc = db.defaultCollection().getMutableDocument("live-2")
+defaultDoc["n"] = 21
+defaultDoc.save()
+assert(db.getDocument("live-2")["n"] == 21)
+otherHandle = Database("db", DatabaseConfiguration("/tmp"))
+otherDoc = otherHandle.getMutableDocument("live-2")
+otherDoc["n"] = 22
+otherHandle.saveDocument(otherDoc)
+assert(db.getDocument("live-2")["n"] == 22)
+otherHandle.close()
+laggingToken.remove()
+assert(db._changeBuffer is None)
+
+
+writeQueue = db.enableWriteBehind(maxLatency=10, merge=lambda pending, new: {"n": pending["n"] + new["n"]})
+writeFutures = [writeQueue.put("wb-1", {"n": 1}) for i in range(100)]
+writeFutures.append(writeQueue.put("wb-2", {"n": 2}))
+writeFutures.append(writeQueue.delete("wb-2"))
+assert(not writeFutures[0].done() and len(writeQueue) == 2)
+assert(writeQueue.flush(5) and all(f.result() is None for f in writeFutures))
+assert(db.getDocument("wb-1")["n"] == 100 and db.getDocument("wb-2") is None)
+assert(writeQueue.stats()["commits"] == 1 and writeQueue.stats()["coalesced"] == 100)
+writeQueue.put("wb-1", {"n": 1})
+assert(writeQueue.flush(5) and db.getDocument("wb-1")["n"] == 1)     # not the cached 100
+cancelledWrite = writeQueue.put("wb-4", {"n": 4})
+assert(cancelledWrite.cancel() and writeQueue.flush(5) and writeQueue.writer is not db)
+assert(cancelledWrite.cancelled() and db.getDocument("wb-4") is None)
+lastWrite = writeQueue.put("wb-3", {"n": 3})
+db.disableWriteBehind()
+assert(lastWrite.done() and db.getDocument("wb-3")["n"] == 3)
+db.disableDocumentCache()
+
+
+if hasattr(lib, "CBLEndpoint_CreateWithLocalDB"):     # Enterprise Edition only
+    Database.deleteFile("replica", "/tmp")
+    replica = Database("replica", DatabaseConfiguration("/tmp"))
+    config = ReplicatorConfiguration(db, replica, push_filter=ReplicationFilter().idPrefix("bulk-"))
+    config.replicator_type = Push
+    config.continuous = False
+    replicator = Replicator(config)
+    statuses, replicated = [], []
+    replicator.addChangeListener(statuses.append)
+    replicator.addDocumentListener(replicated.extend)
+    replicator.start()
+    assert(replicator.waitForIdle(30))
+    metrics = replicator.metrics()
+    bulkCount = replica.count
+    assert(bulkCount > 0 and metrics["pushed"] == bulkCount and metrics["errors"] == 0)
+    assert(metrics["timeToIdle"] > 0 and metrics["docsPerSecond"] > 0 and statuses)
+    time.sleep(0.2)
+    assert(len(replicated) == bulkCount and all(d.isPush and d.collection == "_default._default" for d in replicated))
+    del replicator
+    replica.close()
+    Database.deleteFile("replica", "/tmp")
+
 db.close()
@@ -8,3 +8,4 @@ cd "$SCRIPT_DIR"
 
 export PYTHONPATH=..
 python3 test.py
+python3 stress.py